@@ -10,6 +10,7 @@
 
 #include <rtthread.h>
 #include <rtdevice.h>
+#include <rthw.h>
 #include <at.h>
 #include <stdexcept>
 
@@ -21,7 +22,15 @@
 
 #include <memory>
 
+extern "C" {
+#include <at24cxx.h>
+}
+
+extern at24cxx_device_t at24_dev;
+
 #include "ali_mqtt.h"
+#include "journal.h"
+#include "at_resp.h"
 
 using namespace std;
 
@@ -35,12 +44,47 @@ enum mqtt_event {
 };
 rt_event_t event;
 rt_thread_t thread;
-rt_mailbox_t mailbox;
+
+//poll()只阻塞在这一个消息队列上, 解析线程和发送线程都只做非阻塞投递
+struct PollMsg {
+    enum class Type: rt_uint8_t {
+        Closed, //<- 已连接状态下收到CLOSED
+        Request, //<- RRPC请求
+        Published, //<- 一条RRPC应答发送完成
+    } type;
+    rt_err_t err;
+    RrpcRequest req;
+};
+rt_mq_t poll_mq;
 
 AliMqtt aliMqtt;
 
 char* luat_get_imei();
-char* luat_json_escape(cJSON* root);
+
+//MPUB指令直接在此缓冲区中拼接, 避免整棵JSON树的打印和转义副本
+static char mpub_arena[AT_CMD_MAX_LEN];
+static rt_mutex_t mpub_lock;
+
+template<class F>
+static rt_err_t luat_mpub(at_response_t resp, F fill, int trace = -1) {
+    rt_mutex_take(mpub_lock, RT_WAITING_FOREVER);
+    AtJson w(mpub_arena, sizeof(mpub_arena));
+    w.raw("AT+MPUB=\"");
+    fill(w);
+    w.raw("\"");
+    rrpc_trace_mark(trace, RrpcMark::Encoded);
+
+    rt_err_t err;
+    if(w.overflow()) {
+        LOG_E("mpub payload too long");
+        err = -RT_EFULL;
+    } else {
+        err = at_exec_cmd(resp, "%s", w.c_str());
+    }
+    rrpc_trace_mark(trace, RrpcMark::Sent);
+    rt_mutex_release(mpub_lock);
+    return err;
+}
 
 static void on_http_action(at_client_t client, const char* data, rt_size_t size) {
     LOG_I("on http action");
@@ -60,6 +104,11 @@ static void on_conn_ack(at_client_t client, const char* data, rt_size_t size) {
 static void on_closed(at_client_t client, const char* data, rt_size_t size) {
     LOG_I("on closed");
     rt_event_send(event, mqtt_event_closed);
+    //连接过程中的CLOSED由connect()自己处理, 不再触发一次重连
+    if(aliMqtt.isConnected()) {
+        PollMsg msg = {type: PollMsg::Type::Closed};
+        rt_mq_urgent(poll_mq, &msg, sizeof(msg));
+    }
 }
 
 static void on_sub_ack(at_client_t client, const char* data, rt_size_t size) {
@@ -76,48 +125,21 @@ static void on_already_conn(at_client_t client, const char* data, rt_size_t size
 
 
 
-char* get_req_id_from_data(const char* data) {
-    char* json_str = strstr(data, "{");
-    char* id_end = json_str;
-    while(*id_end != '"')
-        id_end--;
-
-    char* id_begin = id_end;
-    while(*id_begin != '/')
-        id_begin--;
-
-    id_begin++; //恢复到第一个digit的位置
-    id_end--; //移动的最后一个digit的位置
-
-    int str_size = id_end - id_begin + 1;
-    char* id_str = (char*)rt_malloc(str_size + 1);
-    rt_memset(id_str, '\0', str_size + 1);
-    rt_memcpy(id_str, id_begin, str_size);
-
-    return id_str;
-}
-
-//NOTE: MQTT消息处理
+//NOTE: MQTT消息处理, 运行在AT解析线程中, 不分配内存也不阻塞
 static void on_mqtt_msg(at_client_t client, const char* data, rt_size_t size) {
-    LOG_I("on mqtt msg: %s", data);
-    char* json_str = strstr(data, "{");
+    auto stamp = clock_cpu_gettime();
+    LOG_I("on mqtt msg: %.*s", (int)size, data);
 
-    cJSON *root;
-    if(json_str == RT_NULL)
+    PollMsg msg = {type: PollMsg::Type::Request};
+    if(!rrpc_parse(data, size, msg.req))
         return;
 
-    root = cJSON_Parse(json_str); //在这里处理各种json类型
-
-    const char* method = cJSON_item_get_string(root, "method");
-    if(strcmp(method, "thing.service.control") == 0 || strcmp(method, "thing.service.stop") || strcmp(method, "thing.service.query") == 0) {
-        char* reqId = get_req_id_from_data(data);
-        cJSON_AddStringToObject(root, "reqId", reqId);
-        rt_mb_send(mailbox, (rt_uint32_t)root);
-        rt_free(reqId);
-        return;
+    msg.req.trace = rrpc_trace_begin(stamp);
+    rrpc_trace_mark(msg.req.trace, RrpcMark::Parsed);
+    if(rt_mq_send(poll_mq, &msg, sizeof(msg)) != RT_EOK) {
+        LOG_W("rrpc queue full, drop request %s", msg.req.reqId);
+        rrpc_trace_abort(msg.req.trace);
     }
-
-    cJSON_Delete(root);
 }
 
 static struct at_urc urc_table[] = {
@@ -131,29 +153,39 @@ static struct at_urc urc_table[] = {
 };
 
 
-rt_err_t ali_mqtt_service_resp(const char* deviceId, const char* productKey, const char* reqId, cJSON* data) {
-    cJSON *root = RT_NULL;
-
-    root = cJSON_CreateObject();
-    cJSON_AddNumberToObject(root, "id", 233);
-    cJSON_AddNumberToObject(root, "code", 200);
-    cJSON_AddItemReferenceToObject(root, "data", data);
-
-    char* escaped = luat_json_escape(root);
-    at_exec_cmd(RT_NULL, "AT+MPUB=\"/sys/%s/%s/rrpc/response/%s\",0,0,\"%s\"", productKey, deviceId, reqId, escaped);
+template<class F>
+static rt_err_t ali_mqtt_service_resp(const char* deviceId, const char* productKey, const char* reqId, F data, int trace = -1) {
+    //等模块回OK, Sent打点和Published的结果才反映真正的发送结果
+    AtResp resp(64, ALI_AT_TIMEOUT);
+    return luat_mpub(resp.get(), [&](AtJson& w) {
+        w.fmt("/sys/%s/%s/rrpc/response/%s\",0,0,\"", productKey, deviceId, reqId);
+        w.beginObject();
+        w.key("id").num(233);
+        w.key("code").num(200);
+        w.key("data");
+        data(w);
+        w.endObject();
+    }, trace);
+}
 
-    rt_free(escaped);
-    rt_free(root);
-    return RT_EOK;
+static rt_err_t ali_mqtt_service_resp(const char* deviceId, const char* productKey, const char* reqId, int state, int trace = -1) {
+    return ali_mqtt_service_resp(deviceId, productKey, reqId, [&](AtJson& w) {
+        w.beginObject().key("state").num(state).endObject();
+    }, trace);
 }
 
+static void outbox_init();
+static void outbox_kick();
+
 static int init_mqtt() {
-    rt_pin_mode(0, PIN_MODE_OUTPUT);
-    rt_pin_write(0, PIN_LOW);
-    at_client_init("uart2", 512);
+    rt_pin_mode(ALI_MODEM_POWER_PIN, PIN_MODE_OUTPUT);
+    rt_pin_write(ALI_MODEM_POWER_PIN, PIN_LOW);
+    at_client_init(ALI_AT_DEVICE, 512);
     at_set_urc_table(urc_table, sizeof(urc_table) / sizeof(urc_table[0]));
     event = rt_event_create("mqtt_event", RT_IPC_FLAG_PRIO);
-    mailbox = rt_mb_create(LOG_TAG, 64, RT_IPC_FLAG_FIFO);
+    poll_mq = rt_mq_create(LOG_TAG, sizeof(PollMsg), 8, RT_IPC_FLAG_FIFO);
+    outbox_init();
+    mpub_lock = rt_mutex_create("mpub", RT_IPC_FLAG_FIFO);
     return RT_EOK;
 }
 
@@ -182,107 +214,326 @@ char* ali_sign(const char* deviceId, const char* productKey, const char* deviceS
     return hash;
 }
 
-char* luat_json_escape(cJSON* root) {
-    char* json_str = cJSON_PrintUnformatted(root);
-    int quota_cnt = 0;
-    char* token = RT_NULL;
-    for(char* p = json_str; *p != '\0'; p++) {
-        if(*p == '"')
-            quota_cnt++;
+template<class F>
+static rt_err_t ali_mqtt_event_post(const char* deviceId, const char* productKey, const char* eventName, F params) {
+    //等不到OK按发送失败处理, 事件由调用方写入日志, 不会一直占着mpub_lock和AT锁
+    AtResp resp(256, ALI_AT_TIMEOUT);
+
+    char method[48];
+    rt_snprintf(method, sizeof(method), "thing.event.%s.post", eventName);
+
+    return luat_mpub(resp.get(), [&](AtJson& w) {
+        w.fmt("/sys/%s/%s/thing/event/%s/post\",0,0,\"", productKey, deviceId, eventName);
+        w.beginObject();
+        w.key("id").num(233);
+        w.key("version").str("1.0");
+        w.key("method").str(method);
+        w.key("params");
+        params(w);
+        w.endObject();
+    });
+}
+
+//发送队列: 所有MPUB都在mq_tx线程中执行, 控制应答不必排在慢速的属性上报之后
+//断网或发送失败的事件写入片内flash日志, 连上后分批补发
+struct OutMsg {
+    enum class Kind: rt_uint8_t {
+        Response,
+        IcNumber,
+        PortAccess,
+        ChargeCompleted,
+    } kind;
+    bool hasState;
+    rt_int8_t trace; //<- 应答对应的RRPC跟踪槽
+    int port;
+    int value; //<- 应答的state或充电完成的timer_id
+    char text[RRPC_REQ_ID_MAX]; //<- reqId, 卡号或充电结束原因
+};
+
+static rt_mq_t resp_mq, event_mq;
+static rt_event_t outbox_event;
+static AliMqtt::PropertyWriter pending_props[ALI_OUTBOX_PROP_MAX];
+static int pending_prop_cnt = 0;
+
+static rt_err_t outbox_send(const OutMsg& msg) {
+    auto imei = aliMqtt.imei.c_str();
+    switch(msg.kind) {
+        case OutMsg::Kind::Response:
+            if(msg.hasState) {
+                return ali_mqtt_service_resp(imei, PRODUCT_KEY, msg.text, msg.value, msg.trace);
+            }
+            return ali_mqtt_service_resp(imei, PRODUCT_KEY, msg.text, [](AtJson& w) {
+                w.beginObject().endObject();
+            }, msg.trace);
+        case OutMsg::Kind::IcNumber:
+            return ali_mqtt_event_post(imei, PRODUCT_KEY, "ic_number", [&](AtJson& w) {
+                w.beginObject();
+                w.key("port").num(msg.port);
+                w.key("ic_number").str(msg.text);
+                w.endObject();
+            });
+        case OutMsg::Kind::PortAccess:
+            return ali_mqtt_event_post(imei, PRODUCT_KEY, "port_access", [&](AtJson& w) {
+                w.beginObject();
+                w.key("port").num(msg.port);
+                w.endObject();
+            });
+        case OutMsg::Kind::ChargeCompleted:
+            return ali_mqtt_event_post(imei, PRODUCT_KEY, "charge_completed", [&](AtJson& w) {
+                w.beginObject();
+                w.key("port").num(msg.port);
+                w.key("timer_id").num(msg.value);
+                w.key("reason").str(msg.text);
+                w.endObject();
+            });
     }
+    return -RT_EINVAL;
+}
+
+static void outbox_journal(const OutMsg& msg) {
+    JournalRecord rec = {
+        kind: (rt_uint8_t)msg.kind,
+        port: (rt_uint8_t)msg.port,
+        value: msg.value,
+    };
+    rt_strncpy(rec.text, msg.text, sizeof(rec.text) - 1);
+    rec.text[sizeof(rec.text) - 1] = '\0';
+    if(journal.append(rec) == RT_EOK) {
+        LOG_I("offline, event(%d) journaled", rec.kind);
+    }
+}
+
+//每次只补发一批, 有实时消息时让路
+static void outbox_replay() {
+    for(auto i = 0; i < JOURNAL_BATCH && aliMqtt.isConnected(); i++) {
+        if(resp_mq->entry > 0 || event_mq->entry > 0)
+            return;
 
-    char* escaped = (char*)rt_malloc(strlen(json_str) + quota_cnt * 2 + 1);
-    char *p = escaped;
+        JournalRecord rec;
+        auto slot = journal.peek(rec);
+        if(slot < 0)
+            return;
+
+        OutMsg msg = {kind: (OutMsg::Kind)rec.kind, hasState: false, trace: -1, port: rec.port, value: rec.value};
+        rt_memcpy(msg.text, rec.text, sizeof(rec.text));
+        if(outbox_send(msg) != RT_EOK)
+            return;
+        journal.ack(slot);
+    }
+}
 
-    token = strtok(json_str, "\"");
-    while(token != RT_NULL) {
-        strcpy(p, token);
-        p += strlen(token);
-        token = strtok(RT_NULL, "\"");
-        if(token != RT_NULL) {
-            strcpy(p, "\\22");
-            p += 3;
+static void outbox_entry(void* p) {
+    while(true) {
+        rt_event_recv(outbox_event, 1, RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, RT_WAITING_FOREVER, RT_NULL);
+        while(true) {
+            OutMsg msg;
+            if(rt_mq_recv(resp_mq, &msg, sizeof(msg), 0) == RT_EOK) {
+                //RRPC应答只在当前连接上有意义, 断网时直接丢弃
+                rrpc_trace_mark(msg.trace, RrpcMark::Sending);
+                if(aliMqtt.isConnected()) {
+                    PollMsg done = {type: PollMsg::Type::Published, err: outbox_send(msg)};
+                    if(done.err == RT_EOK) {
+                        rrpc_trace_end(msg.trace);
+                    } else {
+                        rrpc_trace_abort(msg.trace);
+                    }
+                    rt_mq_send(poll_mq, &done, sizeof(done));
+                } else {
+                    rrpc_trace_abort(msg.trace);
+                }
+                continue;
+            }
+
+            if(rt_mq_recv(event_mq, &msg, sizeof(msg), 0) == RT_EOK) {
+                if(!aliMqtt.isConnected() || outbox_send(msg) != RT_EOK)
+                    outbox_journal(msg);
+                continue;
+            }
+
+            AliMqtt::PropertyWriter props[ALI_OUTBOX_PROP_MAX];
+            rt_base_t level = rt_hw_interrupt_disable();
+            auto n = pending_prop_cnt;
+            rt_memcpy(props, pending_props, n * sizeof(props[0]));
+            pending_prop_cnt = 0;
+            rt_hw_interrupt_enable(level);
+
+            if(n > 0) {
+                //属性是最新状态的快照, 断网时不保留
+                if(aliMqtt.isConnected()) {
+                    ali_mqtt_event_post(aliMqtt.imei.c_str(), PRODUCT_KEY, "property", [&](AtJson& w) {
+                        w.beginObject();
+                        for(auto i = 0; i < n; i++) {
+                            props[i](w);
+                        }
+                        w.endObject();
+                    });
+                }
+                continue;
+            }
+
+            if(aliMqtt.isConnected() && journal.size() > 0) {
+                auto before = journal.size();
+                outbox_replay();
+                //补发失败时等下一次唤醒(重连或新消息)再试
+                if(journal.size() < before) {
+                    rt_thread_mdelay(100);
+                    continue;
+                }
+            }
+            break;
         }
     }
+}
 
-    rt_free(json_str);
-    return escaped;
+static rt_err_t outbox_post(rt_mq_t mq, const OutMsg& msg) {
+    if(rt_mq_send(mq, (void*)&msg, sizeof(msg)) != RT_EOK) {
+        LOG_W("outbox full, drop message(%d)", (int)msg.kind);
+        return -RT_EFULL;
+    }
+    rt_event_send(outbox_event, 1);
+    return RT_EOK;
 }
 
-int ali_mqtt_event_post(const char* deviceId, const char* productKey, const char* eventName, cJSON* params) {
-    cJSON *root = RT_NULL;
-    char* method = (char*)rt_malloc(64);
-    root = cJSON_CreateObject();
-    cJSON_AddNumberToObject(root, "id", 233);
-    cJSON_AddStringToObject(root, "version", "1.0");
+static rt_err_t outbox_respond(const RrpcRequest& req, bool hasState, int state) {
+    OutMsg msg = {kind: OutMsg::Kind::Response, hasState: hasState, trace: (rt_int8_t)req.trace, port: 0, value: state};
+    rt_strncpy(msg.text, req.reqId, sizeof(msg.text) - 1);
+    rrpc_trace_mark(req.trace, RrpcMark::Handled);
+    auto err = outbox_post(resp_mq, msg);
+    if(err != RT_EOK)
+        rrpc_trace_abort(req.trace);
+    return err;
+}
 
-    rt_sprintf(method, "thing.event.%s.post", eventName);
-    cJSON_AddStringToObject(root, "method", method);
-    cJSON_AddItemReferenceToObject(root, "params", params);
+static void outbox_kick() {
+    rt_event_send(outbox_event, 1);
+}
 
-    auto resp = shared_ptr<at_response>(at_create_resp(256, 0, RT_WAITING_FOREVER), [](auto p) {
-        at_delete_resp(p);
-    });
+static void outbox_init() {
+    resp_mq = rt_mq_create("mq_resp", sizeof(OutMsg), ALI_OUTBOX_RESP_MAX, RT_IPC_FLAG_FIFO);
+    event_mq = rt_mq_create("mq_evt", sizeof(OutMsg), ALI_OUTBOX_EVENT_MAX, RT_IPC_FLAG_FIFO);
+    outbox_event = rt_event_create("mq_tx", RT_IPC_FLAG_FIFO);
+    auto thread = rt_thread_create("mq_tx", outbox_entry, RT_NULL, 1280, 10, 10);
+    rt_thread_startup(thread);
+}
 
-    char* escaped = luat_json_escape(root);
-    at_exec_cmd(resp.get(), "AT+MPUB=\"/sys/%s/%s/thing/event/%s/post\",0,0,\"%s\"", productKey, deviceId, eventName, escaped);
-    rt_free(escaped);
-    cJSON_Delete(root);
-    rt_free(method);
-    return RT_EOK;
+//CGSN的响应没有前缀, 取第一个15位数字的行
+static bool parse_imei(AtResp& resp, void* arg) {
+    for(rt_size_t i = 1; i <= resp.lines(); i++) {
+        auto line = resp.line(i);
+        if(line == RT_NULL || rt_strlen(line) < 15)
+            continue;
+        auto n = 0;
+        while(n < 15 && line[n] >= '0' && line[n] <= '9')
+            n++;
+        if(n == 15) {
+            *(string*)arg = {line, 15};
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_iccid(AtResp& resp, void* arg) {
+    char iccid[22];
+    if(!resp.read("+ICCID:", iccid) || rt_strlen(iccid) < 20)
+        return false;
+    *(string*)arg = {iccid, 20};
+    return true;
 }
 
-//property由本函数负责释放
-int ali_mqtt_set_property(const char* deviceId, const char* productKey, cJSON* property) {
-    return ali_mqtt_event_post(deviceId, productKey, "property", property);
+static bool parse_mqtt_status(AtResp& resp, void* arg) {
+    int status;
+    if(!resp.read("+MQTTSTATU :", status))
+        return false;
+    *(AliMqtt::MqttStatus*)arg = AliMqtt::MqttStatus(status);
+    return true;
 }
 
 void luat_reset() {
-    rt_pin_write(0, PIN_HIGH);
+    rt_pin_write(ALI_MODEM_POWER_PIN, PIN_HIGH);
     rt_thread_mdelay(1000);
-    rt_pin_write(0, PIN_LOW);
+    rt_pin_write(ALI_MODEM_POWER_PIN, PIN_LOW);
 }
 
-rt_err_t AliMqtt::connect() {
-    if(at_client_wait_connect(ALI_AT_TIMEOUT) != RT_EOK) return -RT_ETIMEOUT;
+rt_err_t AliMqtt::connect(Stage from) {
+    //清掉上一次连接残留的URC标志, 否则会被当成本次的CLOSED
+    rt_event_control(event, RT_IPC_CMD_RESET, RT_NULL);
+    if(from == Stage::Reset) {
+        resetHW();
+        if(at_client_wait_connect(ALI_BOOT_TIMEOUT) != RT_EOK) return -RT_ETIMEOUT;
+    } else {
+        if(at_client_wait_connect(ALI_AT_TIMEOUT) != RT_EOK) return -RT_ETIMEOUT;
+    }
     if(closeEcho() != RT_EOK) return -ALI_EDEV_IMEI;
     LOG_I("LUAT已连接");
-    imei = getImeiFromLuat();
-    if(rt_get_errno() != RT_EOK) {
-        return -ALI_EDEV_IMEI;
-    }
-    LOG_I("imei: %s", imei.c_str());
 
-    iccid = getIccidFromLuat();
-    if(rt_get_errno() != RT_EOK) {
+    //IMEI, ICCID和MQTT状态互不依赖, 拼成一行一次查询
+    auto status = MqttStatus::Offline;
+    AtBatch batch(256, ALI_AT_TIMEOUT * 3);
+    if(imei.empty())
+        batch.add("+CGSN", parse_imei, &imei);
+    if(iccid.empty())
+        batch.add("+ICCID", parse_iccid, &iccid);
+    auto statusIdx = batch.add("+MQTTSTATU", parse_mqtt_status, &status);
+    batch.exec();
+
+    if(imei.empty() || iccid.empty()) {
         return -ALI_EDEV_IMEI;
     }
+    LOG_I("imei: %s", imei.c_str());
     LOG_I("iccid: %s", iccid.c_str());
 
-    auto status = getMqttStatus();
-    if(rt_get_errno() != RT_EOK) {
+    if(!batch.ok(statusIdx)) {
         return -ALI_EMQ_STATU;
     }
 
-    LoginParams params;
+    //MQTT离线时至少要重建SSL连接
+    auto stage = from;
     switch(status) {
         case MqttStatus::Online:
             LOG_I("MQTT已连接");
-            break;
+            connected = true;
+            outbox_kick();
+            onConnectedCb();
+            return RT_EOK;
         case MqttStatus::Offline:
+            if(stage < Stage::Ssl)
+                stage = Stage::Ssl;
+            break;
+        case MqttStatus::Unauthorized:
+            //只有平台拒绝了凭据才丢掉缓存的iotToken, 重新走设备认证
+            invalidateLoginParams();
+            if(stage < Stage::Ssl)
+                stage = Stage::Ssl;
+            break;
+    }
+    LOG_I("reconnect from stage %d", (int)stage);
+
+    switch(stage) {
+        case Stage::Reset:
+        case Stage::Gprs:
             if(attachGprs() != RT_EOK) return -ALI_ENET_GPRS;
             LOG_I("GPRS已附着");
+            //no break
+        case Stage::Pdp:
             if(activatePdp() != RT_EOK) return -ALI_ENET_PDP;
             LOG_I("PDP已网络激活");
-            params = getLoginParams();
+            //缓存的iotToken与网络无关, 重新拨号后继续使用
+            //no break
+        case Stage::Ssl: {
+            auto params = getLoginParams();
             if(rt_get_errno() != RT_EOK) return -ALI_EAUTH;
             LOG_I("设备已注册");
             if(mqttConfig(params) != RT_EOK) return -ALI_EMQ_CONF;
             LOG_D("-u: %s, -p: %s", params.username.c_str(), params.password.c_str());
             if(mqttConnectSsl() != RT_EOK) return -ALI_EMQ_SSL;
-            //break;
-        case MqttStatus::Unauthorized:
-            if(mqttConnectSess() != RT_EOK) return -ALI_EMQ_SESS;
+        }
+            //no break
+        case Stage::Session: {
+            auto err = mqttConnectSess();
+            if(err == -ALI_EAUTH) invalidateLoginParams();
+            if(err != RT_EOK) return -ALI_EMQ_SESS;
+        }
             LOG_I("MQTT已连接");
             if(mqttSubTopic("/thing/service/property/set") != RT_EOK) return -ALI_EMQ_TSUB;
             if(mqttSubTopic("/rrpc/request/+") != RT_EOK) return -ALI_EMQ_TSUB;
@@ -291,18 +542,17 @@ rt_err_t AliMqtt::connect() {
     }
 
     connected = true;
+    outbox_kick();
     onConnectedCb();
     return RT_EOK;
 }
 
 rt_err_t AliMqtt::attachGprs() {
-    auto resp = shared_ptr<at_response>(at_create_resp(64, 0, ALI_AT_TIMEOUT), [](auto p) {
-       at_delete_resp(p);
-   });
+    AtResp resp(64, ALI_AT_TIMEOUT);
     int cgatt_val;
     do {
-        if(at_exec_cmd(resp.get(), "AT+CGATT?") != RT_EOK) return -ALI_EAT_E;
-        if(at_resp_parse_line_args_by_kw(resp.get(), "CGATT:", "+CGATT: %d", &cgatt_val) <= 0) return -ALI_EAT_P;
+        if(resp.exec("AT+CGATT?") != RT_EOK) return -ALI_EAT_E;
+        if(!resp.read("+CGATT:", cgatt_val)) return -ALI_EAT_P;
         if(cgatt_val != 1) {
             rt_thread_mdelay(1000);
         }
@@ -311,37 +561,31 @@ rt_err_t AliMqtt::attachGprs() {
 }
 
 rt_err_t AliMqtt::activatePdp() {
-    auto resp = shared_ptr<at_response>(at_create_resp(64, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
+    AtResp resp(64, ALI_AT_TIMEOUT);
     for(auto i = 0; i < 3; i++) {
         int cid, status;
-        if(at_exec_cmd(resp.get(), "AT+SAPBR=2,1") != RT_EOK) return -ALI_EAT_E;
-        if(at_resp_parse_line_args_by_kw(resp.get(), "+SAPBR:", "+SAPBR: %d,%d", &cid, &status) < 2) return -ALI_EAT_P;
+        if(resp.exec("AT+SAPBR=2,1") != RT_EOK) return -ALI_EAT_E;
+        if(!resp.read("+SAPBR:", cid, status)) return -ALI_EAT_P;
         if(status == 1) return RT_EOK;
 
         LOG_W("PDP not activated(%d)", i);
-        if(at_exec_cmd(resp.get(), "AT+SAPBR=3,1,\"CONTYPE\",\"GPRS\"") != RT_EOK) return -ALI_EAT_E;
-        if(at_exec_cmd(resp.get(), "AT+SAPBR=3,1,\"APN\",\"\"") != RT_EOK) return -ALI_EAT_E;
-        if(at_exec_cmd(resp.get(), "AT+SAPBR=1,1") != RT_EOK) return -ALI_EAT_E;
+        if(resp.exec("AT+SAPBR=3,1,\"CONTYPE\",\"GPRS\"") != RT_EOK) return -ALI_EAT_E;
+        if(resp.exec("AT+SAPBR=3,1,\"APN\",\"\"") != RT_EOK) return -ALI_EAT_E;
+        if(resp.exec("AT+SAPBR=1,1") != RT_EOK) return -ALI_EAT_E;
     }
     return -ALI_ETRY_LIMIT;
 }
 
 rt_err_t AliMqtt::mqttConfig(LoginParams& params) {
-    auto resp = shared_ptr<at_response>(at_create_resp(128, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
-    if(at_exec_cmd(resp.get(), "AT+MCONFIG=\"%s\",\"%s\",\"%s\"", imei.c_str(), params.username.c_str(), params.password.c_str()) != RT_EOK) return -ALI_EAT_E;
+    AtResp resp(128, ALI_AT_TIMEOUT);
+    if(resp.exec("AT+MCONFIG=\"%s\",\"%s\",\"%s\"", imei.c_str(), params.username.c_str(), params.password.c_str()) != RT_EOK) return -ALI_EAT_E;
     return RT_EOK;
 }
 
 rt_err_t AliMqtt::mqttConnectSsl() {
-    auto resp = shared_ptr<at_response>(at_create_resp(128, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
+    AtResp resp(128, ALI_AT_TIMEOUT);
 
-    if(at_exec_cmd(resp.get(), "AT+SSLMIPSTART=\"%s.iot-as-mqtt.cn-shanghai.aliyuncs.com\",1883", PRODUCT_KEY) != RT_EOK) return -ALI_EAT_E;
+    if(resp.exec("AT+SSLMIPSTART=\"%s.iot-as-mqtt.cn-shanghai.aliyuncs.com\",1883", PRODUCT_KEY) != RT_EOK) return -ALI_EAT_E;
     rt_uint32_t recved;
     if(rt_event_recv(event, mqtt_event_conn_ok | mqtt_event_already_conn | mqtt_event_closed, RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, ALI_SLL_CONN_TIMEOUT, &recved) != RT_EOK) return -RT_ETIMEOUT;
     if((recved & mqtt_event_closed) != 0) return -ALI_EMQ_STATU;
@@ -349,69 +593,115 @@ rt_err_t AliMqtt::mqttConnectSsl() {
 }
 
 rt_err_t AliMqtt::mqttConnectSess() {
-    auto resp = shared_ptr<at_response>(at_create_resp(128, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
+    AtResp resp(128, ALI_AT_TIMEOUT);
 
-    if(at_exec_cmd(resp.get(), "AT+MCONNECT=1,300") != RT_EOK) return -ALI_EAT_E;
-    rt_event_recv(event, mqtt_event_conn_ack, RT_EVENT_FLAG_AND | RT_EVENT_FLAG_CLEAR, ALI_AT_TIMEOUT, RT_NULL);
+    if(resp.exec("AT+MCONNECT=1,300") != RT_EOK) return -ALI_EAT_E;
+    rt_uint32_t recved;
+    if(rt_event_recv(event, mqtt_event_conn_ack | mqtt_event_closed, RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, ALI_AT_TIMEOUT, &recved) != RT_EOK) return -RT_ETIMEOUT;
+    //没有CONNACK就被关闭, 视为平台拒绝了用户名/密码
+    if(!(recved & mqtt_event_conn_ack)) return -ALI_EAUTH;
     return RT_EOK;
 }
 
 rt_err_t AliMqtt::mqttSubTopic(string topicSuffix) {
-    auto resp = shared_ptr<at_response>(at_create_resp(128, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
+    AtResp resp(128, ALI_AT_TIMEOUT);
 
-    if(at_exec_cmd(resp.get(), "AT+MSUB=\"%s\",0", (makeTopicPrefix() + topicSuffix).c_str()) != RT_EOK) return RT_EOK;
-    rt_event_recv(event, mqtt_event_suback, RT_EVENT_FLAG_AND | RT_EVENT_FLAG_CLEAR, ALI_AT_TIMEOUT, RT_NULL);
+    if(resp.exec("AT+MSUB=\"%s\",0", (makeTopicPrefix() + topicSuffix).c_str()) != RT_EOK) return -ALI_EAT_E;
+    if(rt_event_recv(event, mqtt_event_suback, RT_EVENT_FLAG_AND | RT_EVENT_FLAG_CLEAR, ALI_AT_TIMEOUT, RT_NULL) != RT_EOK) return -ALI_EMQ_TSUB;
     return RT_EOK;
 }
 
-rt_err_t AliMqtt::setProperties(cJSON* properties) {
-    ali_mqtt_set_property(imei.c_str(), PRODUCT_KEY, properties);
-}
-
 string AliMqtt::makeTopicPrefix() {
     return string{"/sys/"} + PRODUCT_KEY + "/" + imei;
 }
 
+//iotToken与获取时的模组时钟一起存在AT24中, 重启后未过期可直接使用
+struct SavedLoginParams {
+    rt_uint32_t magic;
+    rt_uint32_t expires; //<- getClockMinutes()时间, 0表示时钟不可用, 只在认证失败时刷新
+    char username[40];
+    char password[48];
+};
+
+#define ALI_TOKEN_MAGIC 0x544b4e31
+
+bool AliMqtt::loadLoginParams() {
+    SavedLoginParams saved;
+    if(at24cxx_read(at24_dev, ALI_TOKEN_EE_ADDR, (uint8_t*)&saved, sizeof(saved)) != RT_EOK) return false;
+    if(saved.magic != ALI_TOKEN_MAGIC) return false;
+    saved.username[sizeof(saved.username) - 1] = '\0';
+    saved.password[sizeof(saved.password) - 1] = '\0';
+
+    auto now = getClockMinutes();
+    if(saved.expires != 0 && now != 0 && now >= saved.expires) {
+        LOG_I("cached iotToken expired");
+        return false;
+    }
+    params.username = saved.username;
+    params.password = saved.password;
+    tokenExpires = saved.expires;
+    return true;
+}
+
+void AliMqtt::saveLoginParams() {
+    SavedLoginParams saved;
+    rt_memset(&saved, 0, sizeof(saved));
+    if(params.username.size() >= sizeof(saved.username) || params.password.size() >= sizeof(saved.password)) {
+        LOG_W("iotToken too long to cache");
+        return;
+    }
+    auto now = getClockMinutes();
+    saved.magic = ALI_TOKEN_MAGIC;
+    saved.expires = now == 0 ? 0 : now + ALI_TOKEN_LIFETIME;
+    tokenExpires = saved.expires;
+    rt_strncpy(saved.username, params.username.c_str(), sizeof(saved.username) - 1);
+    rt_strncpy(saved.password, params.password.c_str(), sizeof(saved.password) - 1);
+    at24cxx_write(at24_dev, ALI_TOKEN_EE_ADDR, (uint8_t*)&saved, sizeof(saved));
+}
+
+void AliMqtt::invalidateLoginParams() {
+    params = {};
+    tokenExpires = 0;
+    rt_uint32_t magic = 0;
+    at24cxx_write(at24_dev, ALI_TOKEN_EE_ADDR, (uint8_t*)&magic, sizeof(magic));
+}
+
 AliMqtt::LoginParams AliMqtt::getLoginParams() {
-    if(!params.username.empty())
+    if(!params.username.empty() || loadLoginParams()) {
+        rt_set_errno(RT_EOK);
         return params;
+    }
 
-    auto resp = shared_ptr<at_response>(at_create_resp(128, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
+    AtResp resp(128, ALI_AT_TIMEOUT);
     int i;
     for(i = 0; i < 10; i++) {
-        if(at_exec_cmd(resp.get(), "AT+HTTPINIT") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
-        if(at_exec_cmd(resp.get(), "AT+HTTPPARA=\"CID\",1") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
-        if(at_exec_cmd(resp.get(), "AT+HTTPPARA=\"URL\",\"https://iot-auth.cn-shanghai.aliyuncs.com/auth/devicename\"") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
-        if(at_exec_cmd(resp.get(), "AT+HTTPPARA=\"USER_DEFINED\",\"Content-Type: application/x-www-form-urlencoded\"") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
+        if(resp.exec("AT+HTTPINIT") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
+        if(resp.exec("AT+HTTPPARA=\"CID\",1") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
+        if(resp.exec("AT+HTTPPARA=\"URL\",\"https://iot-auth.cn-shanghai.aliyuncs.com/auth/devicename\"") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
+        if(resp.exec("AT+HTTPPARA=\"USER_DEFINED\",\"Content-Type: application/x-www-form-urlencoded\"") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
 
-        at_resp_set_info(resp.get(), 128, 1, ALI_AT_TIMEOUT);
-        if(at_exec_cmd(resp.get(), "AT+HTTPDATA=112,20000") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
-        at_resp_set_info(resp.get(), 128, 0, ALI_AT_TIMEOUT);
+        resp.setInfo(128, 1, ALI_AT_TIMEOUT);
+        if(resp.exec("AT+HTTPDATA=112,20000") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
+        resp.setInfo(128, 0, ALI_AT_TIMEOUT);
 
         auto sign = shared_ptr<char>(ali_sign(imei.c_str(), PRODUCT_KEY, DEVICE_SECRET));
         LOG_D("ali sign: %s", sign.get());
 
-        if(at_exec_cmd(resp.get(), "productKey=%s&sign=%s&clientId=%s&deviceName=%s", PRODUCT_KEY, sign.get(), imei.c_str(), imei.c_str()) != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
-        if(at_exec_cmd(resp.get(), "AT+HTTPACTION=1") != RT_EOK) {
-            at_exec_cmd(resp.get(), "AT+HTTPTERM");
+        if(resp.exec("productKey=%s&sign=%s&clientId=%s&deviceName=%s", PRODUCT_KEY, sign.get(), imei.c_str(), imei.c_str()) != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
+        if(resp.exec("AT+HTTPACTION=1") != RT_EOK) {
+            resp.exec("AT+HTTPTERM");
             continue;
         }
         if(rt_event_recv(event, mqtt_event_http_action, RT_EVENT_FLAG_AND | RT_EVENT_FLAG_CLEAR, 15000, RT_NULL) == RT_EOK)
             break;
         LOG_W("timeout, try again (%d)", i);
-        at_exec_cmd(resp.get(), "AT+HTTPTERM");
+        resp.exec("AT+HTTPTERM");
     }
     if(i >= 10) {rt_set_errno(-ALI_ETRY_LIMIT); return {};}
-    at_resp_set_info(resp.get(), 256, 0, ALI_AT_TIMEOUT);
-    if(at_exec_cmd(resp.get(), "AT+HTTPREAD") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
-    const char* http_resp = at_resp_get_line_by_kw(resp.get(), "code");
-    at_exec_cmd(resp.get(), "AT+HTTPTERM");
+    resp.setInfo(256, 0, ALI_AT_TIMEOUT);
+    if(resp.exec("AT+HTTPREAD") != RT_EOK) {rt_set_errno(-ALI_EAT_E); return {};}
+    const char* http_resp = resp.line("code");
+    resp.exec("AT+HTTPTERM");
     if(http_resp == RT_NULL) {rt_set_errno(-ALI_EAT_P); return {};}
     auto root = shared_ptr<cJSON>(cJSON_Parse(http_resp), [](auto p) {
         cJSON_Delete(p);
@@ -421,25 +711,27 @@ AliMqtt::LoginParams AliMqtt::getLoginParams() {
     if(code != 200) {rt_set_errno(-ALI_EAUTH); return {};}
 
     cJSON* data = cJSON_GetObjectItem(root.get(), "data");
-    params.username = cJSON_item_get_string(data, "iotId");
-    params.password = cJSON_item_get_string(data, "iotToken");
+    auto iotId = cJSON_item_get_string(data, "iotId");
+    auto iotToken = cJSON_item_get_string(data, "iotToken");
+    if(iotId == RT_NULL || iotToken == RT_NULL) {rt_set_errno(-ALI_EAT_P); return {};}
+    params.username = iotId;
+    params.password = iotToken;
+    saveLoginParams();
     rt_set_errno(RT_EOK);
     return params;
 }
 
 
 auto AliMqtt::getMqttStatus() -> MqttStatus {
-    MqttStatus status;
-    auto resp = shared_ptr<at_response>(at_create_resp(128, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
+    AtResp resp(128, ALI_AT_TIMEOUT);
 
-    if(at_exec_cmd(resp.get(), "AT+MQTTSTATU") != RT_EOK) {
+    if(resp.exec("AT+MQTTSTATU") != RT_EOK) {
         rt_set_errno(-ALI_EAT_E);
         return MqttStatus::Offline;
     }
 
-    if(at_resp_parse_line_args_by_kw(resp.get(), "+MQTTSTATU :", "+MQTTSTATU :%d", &status) <= 0) {
+    MqttStatus status;
+    if(!parse_mqtt_status(resp, &status)) {
         rt_set_errno(-ALI_EAT_P);
         return MqttStatus::Offline;
     }
@@ -449,64 +741,57 @@ auto AliMqtt::getMqttStatus() -> MqttStatus {
 }
 
 rt_err_t AliMqtt::closeEcho() {
-    auto resp = shared_ptr<at_response>(at_create_resp(128, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
-    if(at_exec_cmd(resp.get(), "ATE0") != RT_EOK) return -ALI_EAT_E;
+    AtResp resp(128, ALI_AT_TIMEOUT);
+    if(resp.exec("ATE0") != RT_EOK) return -ALI_EAT_E;
     return RT_EOK;
 }
 
 string AliMqtt::getImeiFromLuat() {
     if(!imei.empty())
         return imei;
-    auto resp = shared_ptr<at_response>(at_create_resp(128, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
+    AtResp resp(128, ALI_AT_TIMEOUT);
 
-    if(at_exec_cmd(resp.get(), "AT+CGSN") == RT_EOK) {
-        rt_set_errno(RT_EOK);
-        return {at_resp_get_line(resp.get(), 2), 15};
-    } else {
+    if(resp.exec("AT+CGSN") != RT_EOK) {
         rt_set_errno(ALI_EAT_E);
         return { };
     }
-
+    string result;
+    if(!parse_imei(resp, &result)) {
+        rt_set_errno(-ALI_EAT_P);
+        return { };
+    }
+    rt_set_errno(RT_EOK);
+    return result;
 }
 
 string AliMqtt::getIccidFromLuat() {
     if(!iccid.empty())
         return iccid;
 
-    auto resp = shared_ptr<at_response>(at_create_resp(128, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
-    if(at_exec_cmd(resp.get(), "AT+ICCID") == RT_EOK) {
-        auto iccid = shared_ptr<char>(new char[22]);
-        if(at_resp_parse_line_args_by_kw(resp.get(), "+ICCID:", "+ICCID: %s", iccid.get()) <= 0) {
-            rt_set_errno(-ALI_EAT_P);
-            return { };
-        }
-        rt_set_errno(RT_EOK);
-        return {iccid.get(), 20};
-
-    } else {
+    AtResp resp(128, ALI_AT_TIMEOUT);
+    if(resp.exec("AT+ICCID") != RT_EOK) {
         rt_set_errno(ALI_EAT_E);
         return { };
     }
+    string result;
+    if(!parse_iccid(resp, &result)) {
+        rt_set_errno(-ALI_EAT_P);
+        return { };
+    }
+    rt_set_errno(RT_EOK);
+    return result;
 }
 
 int AliMqtt::getCSQFromLuat() {
-    auto resp = shared_ptr<at_response>(at_create_resp(128, 0, ALI_AT_TIMEOUT), [](auto p) {
-        at_delete_resp(p);
-    });
+    AtResp resp(128, ALI_AT_TIMEOUT);
 
-    if(at_exec_cmd(resp.get(), "AT+CSQ") != RT_EOK) {
+    if(resp.exec("AT+CSQ") != RT_EOK) {
         rt_set_errno(ALI_EAT_E);
         return { };
     }
 
     int result;
-    if(at_resp_parse_line_args_by_kw(resp.get(), "+CSQ:", "+CSQ: %d", &result) <= 0) {
+    if(!resp.read("+CSQ:", result)) {
         rt_set_errno(-ALI_EAT_P);
         return { };
     }
@@ -518,98 +803,164 @@ int AliMqtt::getCSQFromLuat() {
 
 }
 
-rt_err_t AliMqtt::postIcNumberEvent(int port, string icCard) {
-    auto params = shared_ptr<cJSON>(cJSON_CreateObject(), [](auto p) {
-        cJSON_Delete(p);
-    });
+//+CCLK: "20/11/12,08:30:00+32", 换算成自2020年起的分钟数(每月按31天, 只用于比较先后)
+//模组尚未同步网络时间时返回0
+rt_uint32_t AliMqtt::getClockMinutes() {
+    AtResp resp(64, ALI_AT_TIMEOUT);
 
-    cJSON_AddNumberToObject(params.get(), "port", port);
-    cJSON_AddStringToObject(params.get(), "ic_number", icCard.c_str());
+    if(resp.exec("AT+CCLK?") != RT_EOK) return 0;
 
-    ali_mqtt_event_post(imei.c_str(), PRODUCT_KEY, "ic_number", params.get());
-    return RT_EOK;
+    int yy, MM, dd, hh, mm, ss;
+    if(!resp.read("+CCLK:", yy, MM, dd, hh, mm, ss)) return 0;
+    if(yy < 20 || MM < 1 || dd < 1) return 0;
+
+    return ((((yy - 20) * 12 + (MM - 1)) * 31 + (dd - 1)) * 24 + hh) * 60 + mm;
+}
+
+rt_err_t AliMqtt::postIcNumberEvent(int port, string icCard) {
+    OutMsg msg = {kind: OutMsg::Kind::IcNumber, hasState: false, trace: -1, port: port, value: 0};
+    rt_strncpy(msg.text, icCard.c_str(), sizeof(msg.text) - 1);
+    return outbox_post(event_mq, msg);
 }
 
 
 rt_err_t AliMqtt::postPortPlugedEvent(int port) {
-    auto params = shared_ptr<cJSON>(cJSON_CreateObject(), [](auto p) {
-        cJSON_Delete(p);
-    });
+    OutMsg msg = {kind: OutMsg::Kind::PortAccess, hasState: false, trace: -1, port: port, value: 0};
+    return outbox_post(event_mq, msg);
+}
 
-    cJSON_AddNumberToObject(params.get(), "port", port);
+rt_err_t AliMqtt::postChargeCompletedEvent(int port, int timerId, const char* reason) {
+    OutMsg msg = {kind: OutMsg::Kind::ChargeCompleted, hasState: false, trace: -1, port: port, value: timerId};
+    rt_strncpy(msg.text, reason, sizeof(msg.text) - 1);
+    return outbox_post(event_mq, msg);
+}
 
-    ali_mqtt_event_post(imei.c_str(), PRODUCT_KEY, "port_access", params.get());
+rt_err_t AliMqtt::setProperties(PropertyWriter writer) {
+    rt_base_t level = rt_hw_interrupt_disable();
+    for(auto i = 0; i < pending_prop_cnt; i++) {
+        //已在队列中, 发送时渲染的就是最新值
+        if(pending_props[i] == writer) {
+            rt_hw_interrupt_enable(level);
+            return RT_EOK;
+        }
+    }
+    if(pending_prop_cnt == ALI_OUTBOX_PROP_MAX) {
+        rt_hw_interrupt_enable(level);
+        LOG_W("too many pending property writers");
+        return -RT_EFULL;
+    }
+    pending_props[pending_prop_cnt++] = writer;
+    rt_hw_interrupt_enable(level);
+
+    rt_event_send(outbox_event, 1);
     return RT_EOK;
 }
 
-void AliMqtt::poll() {
-    rt_uint32_t recved;
-    while(true) {
-        if(rt_event_recv(event, mqtt_event_closed, RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, 100, &recved) == RT_EOK) {
-            if((recved & mqtt_event_closed) != 0) {
-                connected = false;
-                onTcpClosedCb();
+void AliMqtt::handleRequest(const RrpcRequest& req) {
+    switch(req.method) {
+        case RrpcMethod::Control:
+            if(onControlCb) {
+                outbox_respond(req, true, onControlCb(req.port, req.minutes, req.timerId));
+                return;
             }
-        }
+            break;
+        case RrpcMethod::Stop:
+            if(onStopCb) {
+                outbox_respond(req, true, onStopCb(req.port, req.timerId));
+                return;
+            }
+            break;
+        case RrpcMethod::Query:
+            if(onQueryCb) {
+                onQueryCb();
+                outbox_respond(req, false, 0);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    rrpc_trace_abort(req.trace);
+}
 
-        rt_ubase_t val;
-        if(rt_mb_recv(mailbox, &val, 1000) == RT_EOK) {
-            auto req = shared_ptr<cJSON>((cJSON*)(void*)val, [](auto p) {
-               cJSON_Delete(p);
-            });
+//模组侧可能已断开却没有上报CLOSED, 定期用AT+MQTTSTATU确认
+bool AliMqtt::checkAlive() {
+    auto status = getMqttStatus();
+    if(rt_get_errno() != RT_EOK) {
+        LOG_W("keepalive: status query failed");
+        return true;
+    }
+    return status == MqttStatus::Online;
+}
 
-            const char* reqId = cJSON_item_get_string(req.get(), "reqId");
-            cJSON* params = cJSON_GetObjectItem(req.get(), "params");
+//缓存的iotToken过期后作废, 下次重连时重新认证
+void AliMqtt::checkToken() {
+    if(params.username.empty() || tokenExpires == 0)
+        return;
+    auto now = getClockMinutes();
+    if(now != 0 && now >= tokenExpires) {
+        LOG_I("iotToken expired");
+        invalidateLoginParams();
+    }
+}
 
-            const char* method = cJSON_item_get_string(req.get(), "method");
-            if(strcmp(method, "thing.service.control") == 0) {
-                int port, minutes, timerId;
+void AliMqtt::poll() {
+    auto keepaliveAt = rt_tick_get() + rt_tick_from_millisecond(ALI_KEEPALIVE_PERIOD);
+    auto tokenCheckAt = rt_tick_get() + rt_tick_from_millisecond(ALI_TOKEN_CHECK_PERIOD);
+    auto pubFailures = 0;
 
-                cJSON_item_get_number(params, "port", &port);
-                cJSON_item_get_number(params, "minutes", &minutes);
-                cJSON_item_get_number(params, "timer_id", &timerId);
+    while(true) {
+        auto now = rt_tick_get();
+        auto next = (rt_int32_t)(keepaliveAt - tokenCheckAt) < 0 ? keepaliveAt : tokenCheckAt;
+        auto timeout = (rt_int32_t)(next - now);
+        if(timeout < 0)
+            timeout = 0;
+
+        PollMsg msg;
+        auto closed = false;
+        if(rt_mq_recv(poll_mq, &msg, sizeof(msg), timeout) == RT_EOK) {
+            switch(msg.type) {
+                case PollMsg::Type::Closed:
+                    closed = true;
+                    break;
+                case PollMsg::Type::Request:
+                    rrpc_trace_mark(msg.req.trace, RrpcMark::Dequeued);
+                    handleRequest(msg.req);
+                    break;
+                case PollMsg::Type::Published:
+                    pubFailures = msg.err == RT_EOK ? 0 : pubFailures + 1;
+                    //连续发送失败时提前做一次存活检查
+                    if(pubFailures >= ALI_PUB_FAIL_MAX) {
+                        pubFailures = 0;
+                        keepaliveAt = rt_tick_get();
+                    }
+                    break;
+            }
+        }
 
-                if(aliMqtt.onControlCb) {
-                    auto state = aliMqtt.onControlCb(port, minutes, timerId);
-                    cJSON* data = cJSON_CreateObject();
-                    cJSON_AddNumberToObject(data, "state", state);
+        now = rt_tick_get();
+        if(!closed && (rt_int32_t)(now - keepaliveAt) >= 0) {
+            closed = !checkAlive();
+            keepaliveAt = rt_tick_get() + rt_tick_from_millisecond(ALI_KEEPALIVE_PERIOD);
+        }
+        if((rt_int32_t)(now - tokenCheckAt) >= 0) {
+            checkToken();
+            tokenCheckAt = rt_tick_get() + rt_tick_from_millisecond(ALI_TOKEN_CHECK_PERIOD);
+        }
 
-                    auto imei = aliMqtt.imei.c_str();
-                    ali_mqtt_service_resp(imei, PRODUCT_KEY, reqId, data);
-                    cJSON_Delete(data);
-                }
-            } else if(strcmp(method, "thing.service.stop") == 0) {
-                int port, timerId;
-
-                cJSON_item_get_number(params, "port", &port);
-                cJSON_item_get_number(params, "timer_id", &timerId);
-
-                if(aliMqtt.onStopCb) {
-                    auto state = aliMqtt.onStopCb(port, timerId);
-                    cJSON* data = cJSON_CreateObject();
-                    cJSON_AddNumberToObject(data, "state", state);
-                    ali_mqtt_service_resp(aliMqtt.imei.c_str(), PRODUCT_KEY, reqId, data);
-                    cJSON_Delete(data);
-                }
-            } else if(strcmp(method, "thing.service.query") == 0) {
-                if(aliMqtt.onQueryCb) {
-                    aliMqtt.onQueryCb();
-                    auto data = shared_ptr<cJSON>(cJSON_CreateObject(), [](auto p) {
-                        cJSON_Delete(p);
-                    });
-                    ali_mqtt_service_resp(aliMqtt.imei.c_str(), PRODUCT_KEY, reqId, data.get());
-                }
-            }
+        if(closed && connected) {
+            connected = false;
+            onTcpClosedCb();
+            keepaliveAt = rt_tick_get() + rt_tick_from_millisecond(ALI_KEEPALIVE_PERIOD);
         }
     }
 }
 
 void AliMqtt::resetHW() {
     LOG_W("RESET LUAT");
-    rt_pin_write(0, PIN_HIGH);
+    rt_pin_write(ALI_MODEM_POWER_PIN, PIN_HIGH);
     rt_thread_mdelay(1000);
-    rt_pin_write(0, PIN_LOW);
-    rt_thread_mdelay(5000);
+    rt_pin_write(ALI_MODEM_POWER_PIN, PIN_LOW);
 }
 
 INIT_APP_EXPORT(init_mqtt);
@@ -15,6 +15,8 @@
 #include <cJSON_util.h>
 #include <string>
 #include <functional>
+#include "at_json.h"
+#include "rrpc.h"
 
 //#define DEVICE_ID "863701042917152"
 #define PRODUCT_KEY "a1tltf2GJUn"
@@ -36,16 +38,42 @@
 #define ALI_EMQ_CONF 22
 #define ALI_EMQ_TSUB 23
 
+#ifndef ALI_AT_DEVICE
+#define ALI_AT_DEVICE "uart2" //4G模组所在串口
+#endif
+#ifndef ALI_MODEM_POWER_PIN
+#define ALI_MODEM_POWER_PIN 0
+#endif
+
 #define ALI_AT_TIMEOUT 2000
+#define ALI_BOOT_TIMEOUT 10000 //硬件复位后等待模组响应AT的最长时间
+#define ALI_BACKOFF_MIN 500 //重连退避的初始值(ms)
+#define ALI_BACKOFF_MAX 60000
+#define ALI_TOKEN_EE_ADDR 128 //iotToken在AT24中的存放位置, 前面是端口状态
+#define ALI_TOKEN_LIFETIME (6 * 24 * 60) //iotToken有效期7天, 提前一天刷新(分钟)
+#define ALI_TOKEN_CHECK_PERIOD (60 * 60 * 1000) //检查iotToken是否过期的周期(ms)
+#define ALI_KEEPALIVE_PERIOD 60000 //查询MQTT状态的周期(ms)
+#define ALI_PUB_FAIL_MAX 3 //应答连续发送失败多少次后立即检查连接
+#define ALI_OUTBOX_RESP_MAX 4 //待发送的RRPC应答
+#define ALI_OUTBOX_EVENT_MAX 8 //待发送的事件
+#define ALI_OUTBOX_PROP_MAX 4 //待合并的属性writer
 #define ALI_SLL_CONN_TIMEOUT 20000
 
 cJSON* json_make_item(int port, int timer_id, int left_minutes, int state);
-int ali_mqtt_set_property(const char* deviceId, const char* productKey, cJSON* property);
 
 
 ////仅是接口
 struct AliMqtt {
-    rt_err_t connect();
+    //重连阶段, 由便宜到昂贵; 从某一阶段开始时会执行其后的所有步骤
+    enum class Stage {
+        Session, //<- MCONNECT + 订阅
+        Ssl, //<- TCP/SSL连接, 必要时重新配置MQTT
+        Pdp, //<- 重新激活PDP并刷新iotToken
+        Gprs, //<- 等待GPRS附着
+        Reset, //<- 模组断电重启
+    };
+
+    rt_err_t connect(Stage from = Stage::Session);
 
     rt_err_t closeEcho();
     rt_err_t attachGprs();
@@ -60,17 +88,22 @@ struct AliMqtt {
     rt_err_t mqttConnectSess();
     rt_err_t mqttSubTopic(std::string topicSuffix);
     LoginParams getLoginParams();
+    void invalidateLoginParams();
     std::string makeTopicPrefix();
 
+    //阻塞等待URC、RRPC请求与定时任务, 不返回
     void poll();
     void resetHW();
 
-    //事件触发
+    //以下上报均只入队, 由发送线程按 RRPC应答 > 事件 > 属性 的顺序执行AT+MPUB
     rt_err_t postIcNumberEvent(int port, std::string icCard);
     rt_err_t postPortPlugedEvent(int port);
+    rt_err_t postChargeCompletedEvent(int port, int timerId, const char* reason); //<- 本地结束充电(计时结束或电流判满), 断网时也会补发
 
-    //由caller负责释放properties
-    rt_err_t setProperties(cJSON* properties);
+    //writer在发送时才被调用, 只写params对象的成员; 同一writer排队期间只保留一份,
+    //多个writer合并成一次thing.event.property.post
+    typedef void (*PropertyWriter)(AtJson& w);
+    rt_err_t setProperties(PropertyWriter writer);
 
     void onControl(std::function<int(int, int, int)> cb) {
         onControlCb = cb;
@@ -110,6 +143,12 @@ struct AliMqtt {
     std::string getImeiFromLuat();
     std::string getIccidFromLuat();
     int getCSQFromLuat();
+    rt_uint32_t getClockMinutes();
+    void handleRequest(const RrpcRequest& req);
+    bool checkAlive();
+    void checkToken();
+    bool loadLoginParams();
+    void saveLoginParams();
 
     std::string imei, iccid;
 
@@ -117,6 +156,7 @@ struct AliMqtt {
     std::function<int(int port, int timerId)> onStopCb;
     std::function<void()> onTcpClosedCb, onConnectedCb, onQueryCb;
     LoginParams params;
+    rt_uint32_t tokenExpires = 0;
 
 };
 
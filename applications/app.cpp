@@ -14,6 +14,7 @@
 #include <ali_mqtt.h>
 #include <rtthread.h>
 #include <memory>
+#include <stdlib.h>
 #include <relay.h>
 #include <rtdevice.h>
 #include "rc522.h"
@@ -21,72 +22,107 @@
 #include "state.h"
 #include "light.h"
 #include "port_state.h"
+#include "ports.h"
+#include "executor.h"
+#include "wheel.h"
 
-using namespace std;
+#ifndef RUN_LED_PIN
+#define RUN_LED_PIN 22 //连上平台后点亮
+#endif
+#ifndef APP_WDT_DEVICE
+#define APP_WDT_DEVICE "wdt"
+#endif
 
-#define CURRENT_THRESHOLD 50
+using namespace std;
 
-//电流通道反过来
-//
 //{
 //    "timer_id": 1,
 //    "minutes": 1,
 //    "port": 2
 //}
 
-PortState portStateA(1), portStateB(2);
-PortState* lastInsertPort = nullptr;
+Port* lastInsertPort = nullptr;
 
-rt_timer_t timer, timerWdt;
 
 void tryConeectMqtt();
 void printMqttError(rt_err_t connRes);
 
-cJSON* jsonMakeStateItem(int port, int timer_id, int left_minutes, PortState::Value state, float current, float voltage, float consumption) {
-    cJSON* obj = cJSON_CreateObject();
-    cJSON_AddNumberToObject(obj, "port", port);
-    cJSON_AddNumberToObject(obj, "timer_id", timer_id);
-    cJSON_AddNumberToObject(obj, "left_minutes", left_minutes);
-    cJSON_AddNumberToObject(obj, "state", state);
-    cJSON_AddNumberToObject(obj, "current", current);
-    cJSON_AddNumberToObject(obj, "voltage", voltage);
-    cJSON_AddNumberToObject(obj, "consumption", consumption);
-    return obj;
+//端口状态上报, 字段固定
+struct StateReport {
+    int port, timer_id, left_minutes, state, current, voltage, consumption;
+};
+
+static constexpr struct {
+    const char* name;
+    int StateReport::* field;
+} state_report_schema[] = {
+    {"port", &StateReport::port},
+    {"timer_id", &StateReport::timer_id},
+    {"left_minutes", &StateReport::left_minutes},
+    {"state", &StateReport::state},
+    {"current", &StateReport::current},
+    {"voltage", &StateReport::voltage},
+    {"consumption", &StateReport::consumption},
+};
+
+static StateReport makeStateReport(PortState& ps, float current, float voltage) {
+    return {
+        port: ps.getPort(),
+        timer_id: ps.getTimerId(),
+        left_minutes: ps.getLeftMinutes(),
+        state: ps.get(),
+        current: int(current),
+        voltage: int(voltage),
+        consumption: 0,
+    };
+}
+
+static void writeStateReport(AtJson& w, const StateReport& report) {
+    w.beginObject();
+    for(auto& f: state_report_schema) {
+        w.key(f.name).num(report.*f.field);
+    }
+    w.endObject();
 }
 
 
 void postState();
 
+static Job postStateJob(Lane::Io, [] { postState(); });
+
 rt_device_t wdt_device;
 
+static WheelTimer postStateTimer([](auto p) {
+    postStateJob.submit();
+}, RT_NULL, 10000, true);
+
+static WheelTimer wdtTimer([](auto p) {
+    if(wdt_device) {
+        LOG_I("wdt");
+        rt_device_control(wdt_device, RT_DEVICE_CTRL_WDT_KEEPALIVE, RT_NULL);
+    }
+}, RT_NULL, 5000, true);
+
 extern "C"
 void run() {
     hlw.config();
-    rt_pin_mode(22, PIN_MODE_OUTPUT);
-    rt_pin_write(22, PIN_LOW);
+    rt_pin_mode(RUN_LED_PIN, PIN_MODE_OUTPUT);
+    rt_pin_write(RUN_LED_PIN, PIN_LOW);
 
     aliMqtt.onConnected([](){
-        rt_pin_write(22, PIN_HIGH);
-        auto properties = shared_ptr<cJSON>(cJSON_CreateObject(), [](auto p) {
-            cJSON_Delete(p);
+        rt_pin_write(RUN_LED_PIN, PIN_HIGH);
+        aliMqtt.setProperties([](AtJson& w) {
+            w.key("iccid").str(aliMqtt.iccid.c_str());
         });
-        cJSON_AddStringToObject(properties.get(), "iccid", aliMqtt.iccid.c_str());
-        aliMqtt.setProperties(properties.get());
     });
 
     aliMqtt.onControl([](auto port, auto minutes, auto timerId){
         LOG_I("开始充电: port=%d, duration=%dmin, timerId=%d", port, minutes, timerId);
-        switch(port) {
-            case 1:
-                relay_ctl(Relay::First, PIN_HIGH);
-                light1.setState(Light::State::LoadAndPaid);
-                portStateA.startCharging(minutes, timerId);
-                break;
-            case 2:
-                relay_ctl(Relay::Second, PIN_HIGH);
-                light2.setState(Light::State::LoadAndPaid);
-                portStateB.startCharging(minutes, timerId);
-                break;
+        auto p = ports.get(port);
+        if(p != nullptr) {
+            p->relay(true);
+            p->light.setState(Light::State::LoadAndPaid);
+            p->state.startCharging(minutes, timerId);
         }
         wtn6 << VoiceFrg::StartCharing;
         return 1;
@@ -94,151 +130,86 @@ void run() {
 
     aliMqtt.onStop([](auto port, auto timerId){
         LOG_I("停止充电: port=%d, timerId:%d", port, timerId);
-        switch(port) {
-            case 1:
-                relay_ctl(Relay::First, PIN_LOW);
-                light1.setState(Light::State::LoadButNotPay);
-                portStateA.stopCharging(timerId);
-                wtn6 << VoiceFrg::ChargeCompleted;
-                break;
-            case 2:
-                relay_ctl(Relay::Second, PIN_LOW);
-                light2.setState(Light::State::LoadButNotPay);
-                portStateB.stopCharging(timerId);
-                wtn6 << VoiceFrg::ChargeCompleted;
-                break;
+        auto p = ports.get(port);
+        if(p != nullptr) {
+            p->relay(false);
+            p->light.setState(Light::State::LoadButNotPay);
+            p->state.stopCharging(timerId);
         }
         wtn6 << VoiceFrg::ChargeCompleted;
         return 1;
     });
 
     rc522.onCardInserted([](rt_uint32_t icNumber) {
-        if(lastInsertPort == nullptr || lastInsertPort->isCharging()) {
+        if(lastInsertPort == nullptr || lastInsertPort->state.isCharging()) {
             wtn6 << VoiceFrg::PlugNotReady;
             return;
         }
 
-        auto cvt = shared_ptr<char>(new char[9]);
-        rt_sprintf(cvt.get(), "%08x", icNumber);
-        aliMqtt.postIcNumberEvent(lastInsertPort->getPort(), cvt.get());
+        char cvt[9];
+        rt_sprintf(cvt, "%08x", icNumber);
+        aliMqtt.postIcNumberEvent(lastInsertPort->num(), cvt);
         wtn6 << VoiceFrg::CardDetected;
     });
 
-    lodDetectA.onStateChanged([](auto state){
-        if(portStateA.isCharging())
-            return;
+    for(auto& port: ports) {
+        auto p = &port;
 
-        if(state) { // 0 -> 1
-            if(portStateA.isLoadInserted())
+        p->detect.onStateChanged([p](auto state){
+            if(p->state.isCharging())
                 return;
-            wtn6 << VoiceFrg::PortAPluged;
-            aliMqtt.postPortPlugedEvent(1);
-            light1.setState(Light::State::LoadButNotPay);
-            lastInsertPort = &portStateA;
-            portStateA.loadInserted();
-            LOG_D("A插座已经插入");
-        } else {
-            wtn6 << VoiceFrg::PortAUnpluged;
-            light1.setState(Light::State::LoadNotReady);
-            portStateA.loadRemoved();
-            if(lastInsertPort == &portStateA) {
-                lastInsertPort = nullptr;
-            }
-            LOG_D("A插座已经拔出");
-        }
-    });
-
-    lodDetectB.onStateChanged([](auto state){
-        if(portStateB.isCharging())
-            return;
 
-        if(state) {
-            if(portStateB.isLoadInserted())
-                return;
-            wtn6 << VoiceFrg::PortBPluged;
-            aliMqtt.postPortPlugedEvent(2);
-            light2.setState(Light::State::LoadButNotPay);
-            lastInsertPort = &portStateB;
-            portStateB.loadInserted();
-            LOG_D("B插座已经插入");
-        } else {
-            wtn6 << VoiceFrg::PortBUnpluged;
-            light2.setState(Light::State::LoadNotReady);
-            portStateB.loadRemoved();
-            if(lastInsertPort == &portStateB) {
-                lastInsertPort = nullptr;
+            if(state) { // 0 -> 1
+                if(p->state.isLoadInserted())
+                    return;
+                wtn6 << p->desc.pluged;
+                aliMqtt.postPortPlugedEvent(p->num());
+                p->light.setState(Light::State::LoadButNotPay);
+                lastInsertPort = p;
+                p->state.loadInserted();
+                LOG_D("%d号插座已经插入", p->num());
+            } else {
+                wtn6 << p->desc.unpluged;
+                p->light.setState(Light::State::LoadNotReady);
+                p->state.loadRemoved();
+                if(lastInsertPort == p) {
+                    lastInsertPort = nullptr;
+                }
+                LOG_D("%d号插座已经拔出", p->num());
             }
-            LOG_D("B插座已经拔出");
-        }
-    });
-
-    portStateA.onInternalChargeOver([](){
-        //if(!aliMqtt.isConnected()) {
-        relay_ctl(Relay::First, PIN_LOW);
-        light1.setState(Light::State::LoadButNotPay);
-        portStateA.stopCharging(0);
-        wtn6 << VoiceFrg::ChargeCompleted;
-
-        //}
-    });
-
-    portStateB.onInternalChargeOver([](){
-        //if(!aliMqtt.isConnected()) {
-        relay_ctl(Relay::Second, PIN_LOW);
-        light2.setState(Light::State::LoadButNotPay);
-        portStateB.stopCharging(0);
-        wtn6 << VoiceFrg::ChargeCompleted;
-        //}
-    });
-
-    portStateA.onResumePortOpenRequired([]() {
-        if(!lodDetectA.isInserted())
-            return false;
-        relay_ctl(Relay::First, PIN_HIGH);
-        light1.setState(Light::State::LoadAndPaid);
-        return true;
-    });
-
+        });
 
-    portStateB.onResumePortOpenRequired([]() {
-        if(!lodDetectB.isInserted())
-            return false;
-        relay_ctl(Relay::Second, PIN_HIGH);
-        light2.setState(Light::State::LoadAndPaid);
-        return true;
-    });
+        p->state.onInternalChargeOver([p](auto reason){
+            p->relay(false);
+            p->light.setState(Light::State::LoadButNotPay);
+            aliMqtt.postChargeCompletedEvent(p->num(), p->state.getTimerId(), PortState::reasonName(reason));
+            p->state.stopCharging(0);
+            wtn6 << VoiceFrg::ChargeCompleted;
+        });
 
-    portStateA.resume();
-    portStateB.resume();
+        p->state.onResumePortOpenRequired([p]() {
+            if(!p->detect.isInserted())
+                return false;
+            p->relay(true);
+            p->light.setState(Light::State::LoadAndPaid);
+            return true;
+        });
 
-    if(lodDetectA.isInserted()) {
-        portStateA.loadInserted();
-    } else {
-        portStateA.loadRemoved();
-    }
+        p->state.resume();
 
-    if(lodDetectB.isInserted()) {
-        portStateB.loadInserted();
-    } else {
-        portStateB.loadRemoved();
+        if(p->detect.isInserted()) {
+            p->state.loadInserted();
+        } else {
+            p->state.loadRemoved();
+        }
     }
 
     aliMqtt.onQuery([](){
         postState();
     });
 
-    timer = rt_timer_create(LOG_TAG, [](auto p) {
-        postState();
-    }, RT_NULL, 10000, RT_TIMER_FLAG_PERIODIC | RT_TIMER_FLAG_SOFT_TIMER);
-    rt_timer_start(timer);
-
-    timerWdt = rt_timer_create(LOG_TAG, [](auto p) {
-        if(wdt_device) {
-            LOG_I("wdt");
-            rt_device_control(wdt_device, RT_DEVICE_CTRL_WDT_KEEPALIVE, RT_NULL);
-        }
-    }, RT_NULL, 5000, RT_TIMER_FLAG_PERIODIC | RT_TIMER_FLAG_SOFT_TIMER);
-    rt_timer_start(timerWdt);
+    postStateTimer.start();
+    wdtTimer.start();
 
     aliMqtt.onTcpClosed([]{
         rt_device_close(wdt_device);
@@ -251,18 +222,30 @@ void run() {
 
 }
 
+//先重试最便宜的阶段, 每失败一次升级一级, 直到断电重启模组; 两次尝试之间按带抖动的指数退避等待
 void tryConeectMqtt() {
-    rt_thread_mdelay(5000);
+    auto stage = AliMqtt::Stage::Session;
+    auto backoff = ALI_BACKOFF_MIN;
     while(true) {
-        auto connRes = aliMqtt.connect();
-        if(connRes != RT_EOK) {
-            printMqttError(connRes);
-            aliMqtt.resetHW();
-            continue;
+        auto connRes = aliMqtt.connect(stage);
+        if(connRes == RT_EOK)
+            break;
+
+        printMqttError(connRes);
+        if(stage != AliMqtt::Stage::Reset) {
+            stage = (AliMqtt::Stage)((int)stage + 1);
+        }
+        static auto seeded = false;
+        if(!seeded) {
+            srand(rt_tick_get()); //<- 首次失败的时刻受网络影响, 足以让各设备错开
+            seeded = true;
         }
-        break;
+        auto delay = backoff / 2 + rand() % backoff;
+        LOG_I("retry in %dms", delay);
+        rt_thread_mdelay(delay);
+        backoff = backoff * 2 > ALI_BACKOFF_MAX ? ALI_BACKOFF_MAX : backoff * 2;
     }
-    wdt_device = rt_device_find("wdt");
+    wdt_device = rt_device_find(APP_WDT_DEVICE);
     rt_device_init(wdt_device);
 
     int timeout = 25;
@@ -271,48 +254,35 @@ void tryConeectMqtt() {
 }
 
 
-void postState() {
-    if(!aliMqtt.isConnected())
-        return;
-
-    auto properties = shared_ptr<cJSON>(cJSON_CreateObject(), [](auto p) {
-        cJSON_Delete(p);
-    });
-
-    cJSON *current_data = cJSON_CreateArray();
-    cJSON_AddItemToObject(properties.get(), "current_data", current_data);
-
-    rt_err_t err = RT_EOK;
-    float iA, iB, u;
-
-    do {
-        iA = hlw.getI<Hlw::Port::A>(&err);
-        if(err != RT_EOK) {
-            LOG_E("IA FATAL");
-        }
-    } while(err != RT_EOK);
-
-    do {
-        iB = hlw.getI<Hlw::Port::B>(&err);
-        if(err != RT_EOK) {
-            LOG_E("IB FATAL");
-        }
-    } while(err != RT_EOK);
-
-    do {
-        u = hlw.getU(&err);
-        if(err != RT_EOK) {
-            LOG_E("U FATAL");
-        }
-    } while(err != RT_EOK);
+static int lastSignal = 0;
 
-    cJSON_AddItemToArray(current_data, jsonMakeStateItem(portStateA.getPort(), portStateA.getTimerId(), portStateA.getLeftMinutes(), portStateA.get(), int(iB), int(u), 0));
-    cJSON_AddItemToArray(current_data, jsonMakeStateItem(portStateB.getPort(), portStateB.getTimerId(), portStateB.getLeftMinutes(), portStateB.get(), int(iA), int(u), 0));
+static void writeStateProperties(AtJson& w) {
+    Hlw::Snapshot snap;
+    if(!hlw.latest(snap)) {
+        LOG_W("no metering data yet");
+    } else if(hlw.getHealth().degraded) {
+        LOG_W("metering degraded, last good value %dms old", Hlw::getAge(snap) * 1000 / RT_TICK_PER_SECOND);
+    }
+    auto& m = snap.m;
 
-    cJSON_AddNumberToObject(properties.get(), "signal", aliMqtt.getCSQFromLuat());
+    w.key("current_data").beginArray();
+    for(auto& p: ports) {
+        writeStateReport(w, makeStateReport(p.state, m.i(p.desc.channel), m.u));
+    }
+    w.endArray();
+    w.key("signal").num(lastSignal);
+}
 
-    aliMqtt.setProperties(properties.get());
+//信号强度需要单独的AT查询, 其余字段在发送线程渲染时才读取
+void postState() {
+    if(!aliMqtt.isConnected())
+        return;
 
+    lastSignal = aliMqtt.getCSQFromLuat();
+    aliMqtt.setProperties(writeStateProperties);
+#ifdef RRPC_STATS_PROPERTY
+    aliMqtt.setProperties(rrpc_stats_write);
+#endif
 }
 
 void printMqttError(rt_err_t connRes) {
@@ -349,11 +319,3 @@ void printMqttError(rt_err_t connRes) {
             break;
     }
 }
-
-int init_port_state() {
-    portStateA.init();
-    portStateB.init();
-    return RT_EOK;
-}
-
-INIT_APP_EXPORT(init_port_state);
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-08     imgcr       the first version
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include "at_json.h"
+
+AtJson::AtJson(char* buf, int cap): buf(buf), cap(cap) {
+    buf[0] = '\0';
+}
+
+void AtJson::put(char c) {
+    if(ovf)
+        return;
+    if(len + 1 >= cap) {
+        ovf = true;
+        return;
+    }
+    buf[len++] = c;
+    buf[len] = '\0';
+}
+
+void AtJson::put(const char* s) {
+    while(*s != '\0')
+        put(*s++);
+}
+
+void AtJson::escaped(const char* s) {
+    put("\\22");
+    for(; *s != '\0'; s++) {
+        switch(*s) {
+            case '"':
+                put("\\5C\\22");
+                break;
+            case '\\':
+                put("\\5C\\5C");
+                break;
+            case '\r':
+                put("\\5Cr");
+                break;
+            case '\n':
+                put("\\5Cn");
+                break;
+            default:
+                if((unsigned char)*s >= 0x20) {
+                    put(*s);
+                } else {
+                    //其余控制字符按JSON的\u00XX输出, 反斜杠同样要写成\5C
+                    static const char hex[] = "0123456789ABCDEF";
+                    put("\\5Cu00");
+                    put(hex[(unsigned char)*s >> 4]);
+                    put(hex[*s & 0x0f]);
+                }
+                break;
+        }
+    }
+    put("\\22");
+}
+
+void AtJson::sep() {
+    if(afterKey) {
+        afterKey = false;
+        return;
+    }
+    if(depth == 0)
+        return;
+    auto bit = 1u << (depth - 1);
+    if((first & bit) == 0)
+        put(',');
+    first &= ~bit;
+}
+
+void AtJson::open(char c) {
+    sep();
+    put(c);
+    if(depth >= AT_JSON_DEPTH_MAX) {
+        ovf = true;
+        return;
+    }
+    depth++;
+    first |= 1u << (depth - 1);
+}
+
+void AtJson::close(char c) {
+    if(depth > 0)
+        depth--;
+    put(c);
+}
+
+AtJson& AtJson::raw(const char* s) {
+    put(s);
+    return *this;
+}
+
+AtJson& AtJson::fmt(const char* fmt, ...) {
+    if(ovf)
+        return *this;
+    va_list args;
+    va_start(args, fmt);
+    auto n = vsnprintf(buf + len, cap - len, fmt, args);
+    va_end(args);
+    if(n < 0 || len + n >= cap) {
+        buf[len] = '\0';
+        ovf = true;
+    } else {
+        len += n;
+    }
+    return *this;
+}
+
+AtJson& AtJson::beginObject() {
+    open('{');
+    return *this;
+}
+
+AtJson& AtJson::endObject() {
+    close('}');
+    return *this;
+}
+
+AtJson& AtJson::beginArray() {
+    open('[');
+    return *this;
+}
+
+AtJson& AtJson::endArray() {
+    close(']');
+    return *this;
+}
+
+AtJson& AtJson::key(const char* k) {
+    sep();
+    escaped(k);
+    put(':');
+    afterKey = true;
+    return *this;
+}
+
+AtJson& AtJson::str(const char* s) {
+    sep();
+    escaped(s == RT_NULL ? "" : s);
+    return *this;
+}
+
+AtJson& AtJson::num(int v) {
+    sep();
+    return fmt("%d", v);
+}
+
+AtJson& AtJson::num(double v) {
+    //与cJSON一致, 整数值不带小数部分
+    if(fabs(floor(v) - v) <= 1e-9 && fabs(v) < 1.0e9)
+        return num((int)v);
+    sep();
+    return fmt("%g", v);
+}
+
+AtJson& AtJson::boolean(bool v) {
+    sep();
+    put(v ? "true" : "false");
+    return *this;
+}
+
+AtJson& AtJson::null() {
+    sep();
+    put("null");
+    return *this;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-08     imgcr       the first version
+ */
+#ifndef APPLICATIONS_AT_JSON_H_
+#define APPLICATIONS_AT_JSON_H_
+
+#include <rtthread.h>
+
+#define AT_JSON_DEPTH_MAX 8
+
+//将JSON直接写成Luat AT指令字符串参数的形式: 结构引号写成\22, 字符串内的引号和反斜杠写成\5C\22, \5C\5C
+//所有输出都写入调用者提供的定长缓冲区, 不分配堆内存, 溢出后后续写入全部忽略
+struct AtJson {
+    AtJson(char* buf, int cap);
+
+    AtJson& raw(const char* s);
+    AtJson& fmt(const char* fmt, ...);
+
+    AtJson& beginObject();
+    AtJson& endObject();
+    AtJson& beginArray();
+    AtJson& endArray();
+    AtJson& key(const char* k);
+
+    AtJson& str(const char* s);
+    AtJson& num(int v);
+    AtJson& num(double v);
+    AtJson& boolean(bool v);
+    AtJson& null();
+
+    const char* c_str() const {
+        return buf;
+    }
+
+    int size() const {
+        return len;
+    }
+
+    bool overflow() const {
+        return ovf;
+    }
+
+private:
+    void put(char c);
+    void put(const char* s);
+    void escaped(const char* s);
+    void sep();
+    void open(char c);
+    void close(char c);
+
+    char* buf;
+    int cap, len = 0;
+    bool ovf = false;
+    bool afterKey = false;
+    int depth = 0;
+    rt_uint32_t first = 0; //<- 每层是否还未写过元素
+};
+
+#endif /* APPLICATIONS_AT_JSON_H_ */
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-14     imgcr       the first version
+ */
+
+#include "at_resp.h"
+
+AtFields::AtFields(const char* line): p(line) {
+    if(p == RT_NULL)
+        return;
+    while(*p != '\0' && *p != ':')
+        p++;
+    if(*p == ':')
+        p++;
+}
+
+bool AtFields::next(int& v) {
+    if(p == RT_NULL)
+        return false;
+    while(*p != '\0' && !(*p >= '0' && *p <= '9') && !(*p == '-' && p[1] >= '0' && p[1] <= '9'))
+        p++;
+    if(*p == '\0')
+        return false;
+
+    bool neg = *p == '-';
+    if(neg)
+        p++;
+    int r = 0;
+    for(; *p >= '0' && *p <= '9'; p++)
+        r = r * 10 + (*p - '0');
+    v = neg ? -r : r;
+    return true;
+}
+
+bool AtFields::next(char* buf, rt_size_t size) {
+    if(p == RT_NULL || size == 0)
+        return false;
+    while(*p == ' ' || *p == ',')
+        p++;
+    if(*p == '\0')
+        return false;
+
+    bool quoted = *p == '"';
+    if(quoted)
+        p++;
+    rt_size_t n = 0;
+    for(; *p != '\0' && *p != '"' && (quoted || *p != ','); p++) {
+        if(n + 1 < size)
+            buf[n++] = *p;
+    }
+    buf[n] = '\0';
+    if(quoted && *p == '"')
+        p++;
+    return true;
+}
+
+int AtBatch::add(const char* cmd, Parser parser, void* arg) {
+    if(count >= AT_BATCH_MAX)
+        return -1;
+    items[count] = {cmd: cmd, parser: parser, arg: arg, ok: false};
+    return count++;
+}
+
+//整行执行且每条都解析成功返回true; 超时也算已处理, 不再逐条重试
+//整行OK但个别应答缺失或错位时返回false, 由exec()只对解析失败的几条逐条重试
+bool AtBatch::execJoined(rt_err_t& err) {
+    char line[AT_BATCH_LINE_MAX];
+    int len = rt_snprintf(line, sizeof(line), "AT");
+    for(int i = 0; i < count; i++) {
+        len += rt_snprintf(line + len, sizeof(line) - len, i == 0 ? "%s" : ";%s", items[i].cmd);
+        if(len >= (int)sizeof(line) - 1)
+            return false;
+    }
+
+    AtResp resp(bufSize, rt_tick_from_millisecond(deadline));
+    err = resp.exec("%s", line);
+    if(err == -RT_ETIMEOUT)
+        return true;
+    if(err != RT_EOK)
+        return false;
+
+    auto all = true;
+    for(int i = 0; i < count; i++) {
+        items[i].ok = items[i].parser(resp, items[i].arg);
+        all = all && items[i].ok;
+    }
+    return all;
+}
+
+rt_err_t AtBatch::exec() {
+    auto end = rt_tick_get() + rt_tick_from_millisecond(deadline);
+    rt_err_t err = RT_EOK;
+    if(count > 1 && execJoined(err))
+        return err;
+
+    err = RT_EOK;
+    AtResp resp(bufSize, rt_tick_from_millisecond(deadline));
+    for(int i = 0; i < count; i++) {
+        if(items[i].ok)
+            continue;
+        auto left = (rt_int32_t)(end - rt_tick_get());
+        if(left <= 0)
+            return -RT_ETIMEOUT;
+        resp.setInfo(bufSize, 0, left); //<- 超时以tick计
+        if(resp.exec("AT%s", items[i].cmd) != RT_EOK) {
+            err = -RT_ERROR;
+            continue;
+        }
+        items[i].ok = items[i].parser(resp, items[i].arg);
+        if(!items[i].ok)
+            err = -RT_ERROR;
+    }
+    return err;
+}
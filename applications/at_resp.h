@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-14     imgcr       the first version
+ */
+#ifndef APPLICATIONS_AT_RESP_H_
+#define APPLICATIONS_AT_RESP_H_
+
+#include <rtthread.h>
+#include <at.h>
+#include <initializer_list>
+
+//逐个读取"+CMD: 1,2,"abc""这类响应行中冒号之后的字段, 直接在响应缓冲区上解析, 不经过vsscanf
+//整数字段跳过前面的任意分隔符, 所以"+CCLK: "20/11/12,08:30:00""也可以连续读出6个整数
+struct AtFields {
+    explicit AtFields(const char* line);
+
+    bool next(int& v);
+    bool next(char* buf, rt_size_t size); //<- 去掉引号, 读到逗号或引号结束
+
+    template<rt_size_t N>
+    bool next(char (&buf)[N]) {
+        return next(buf, N);
+    }
+
+    explicit operator bool() const {
+        return p != RT_NULL;
+    }
+
+private:
+    const char* p;
+};
+
+//at_response的RAII包装, 对象由at_create_resp从AT组件的内存池中取出, 析构时归还
+struct AtResp {
+    AtResp(rt_size_t bufSize, rt_int32_t timeout, rt_size_t lineNum = 0): resp(at_create_resp(bufSize, lineNum, timeout)) {}
+    ~AtResp() {
+        if(resp != RT_NULL)
+            at_delete_resp(resp);
+    }
+    AtResp(const AtResp&) = delete;
+    AtResp& operator=(const AtResp&) = delete;
+
+    template<class... Args>
+    rt_err_t exec(const char* fmt, Args... args) {
+        if(resp == RT_NULL)
+            return -RT_ENOMEM;
+        return at_exec_cmd(resp, fmt, args...);
+    }
+
+    rt_err_t setInfo(rt_size_t bufSize, rt_size_t lineNum, rt_int32_t timeout) {
+        return at_resp_set_info(resp, bufSize, lineNum, timeout) != RT_NULL ? RT_EOK : -RT_ENOMEM;
+    }
+
+    const char* line(rt_size_t n) const {
+        return resp != RT_NULL ? at_resp_get_line(resp, n) : RT_NULL;
+    }
+
+    const char* line(const char* keyword) const {
+        return resp != RT_NULL ? at_resp_get_line_by_kw(resp, keyword) : RT_NULL;
+    }
+
+    AtFields fields(const char* keyword) const {
+        return AtFields(line(keyword));
+    }
+
+    //按顺序读出keyword所在行的全部字段, 全部读到才返回true
+    template<class... Ts>
+    bool read(const char* keyword, Ts&... out) {
+        auto f = fields(keyword);
+        bool ok = bool(f);
+        (void)std::initializer_list<int>{(ok = ok && f.next(out), 0)...};
+        return ok;
+    }
+
+    rt_size_t lines() const {
+        return resp != RT_NULL ? resp->line_counts : 0;
+    }
+
+    at_response_t get() const {
+        return resp;
+    }
+
+private:
+    at_response_t resp;
+};
+
+#define AT_BATCH_MAX 6
+#define AT_BATCH_LINE_MAX 96
+
+//把互不依赖的查询用';'拼成一行发出(V.25ter命令行串接), 模组依次执行后只回一个OK, 再按顺序交给各自的解析函数
+//模组的串口命令解释器一次只处理一行, 这已经是它能接受的最大并行度
+//某一条返回ERROR会使整行失败, 这时在剩余的期限内退回逐条执行, 解析函数在两种情况下看到的是同样的响应行
+struct AtBatch {
+    using Parser = bool(*)(AtResp& resp, void* arg);
+
+    AtBatch(rt_size_t bufSize, rt_int32_t deadline): bufSize(bufSize), deadline(deadline) {}
+
+    //cmd不带"AT"前缀, 如"+CSQ", 返回序号, 满了返回-1
+    int add(const char* cmd, Parser parser, void* arg = RT_NULL);
+    rt_err_t exec();
+
+    bool ok(int i) const {
+        return i >= 0 && i < count && items[i].ok;
+    }
+
+private:
+    struct Item {
+        const char* cmd;
+        Parser parser;
+        void* arg;
+        bool ok;
+    };
+
+    bool execJoined(rt_err_t& err);
+
+    Item items[AT_BATCH_MAX];
+    int count = 0;
+    rt_size_t bufSize;
+    rt_int32_t deadline; //<- 整批的总期限(ms)
+};
+
+#endif /* APPLICATIONS_AT_RESP_H_ */
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-16     imgcr       the first version
+ */
+
+#include <rtthread.h>
+#include <stddef.h>
+
+extern "C" {
+#include <at24cxx.h>
+}
+
+#include "ee_log.h"
+
+#define LOG_TAG "ee_log"
+#define LOG_LVL LOG_LVL_DBG
+#include <ulog.h>
+
+extern at24cxx_device_t at24_dev;
+
+EeLog::EeLog(rt_uint16_t addr, rt_uint16_t size, rt_uint16_t payloadSize): addr(addr), payloadSize(payloadSize) {
+    slotSize = RT_ALIGN(sizeof(Header) + payloadSize, EE_PAGE_SIZE);
+    slots = size / slotSize;
+    RT_ASSERT(slotSize <= EE_LOG_SLOT_MAX && slots >= 2);
+    rt_mutex_init(&lock, "ee_log", RT_IPC_FLAG_FIFO);
+}
+
+//CRC-16/CCITT
+rt_uint16_t EeLog::crcOf(const rt_uint8_t* slot, rt_uint16_t payloadSize) {
+    rt_uint16_t crc = 0xffff;
+    auto end = slot + sizeof(Header) + payloadSize;
+    for(auto p = slot; p < end; p++) {
+        if(p == slot + offsetof(Header, crc)) {
+            p += sizeof(Header::crc) - 1;
+            continue;
+        }
+        crc ^= (rt_uint16_t)*p << 8;
+        for(auto i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+bool EeLog::recover(void* payload) {
+    rt_uint8_t buf[EE_LOG_SLOT_MAX];
+    auto header = (Header*)buf;
+    int newest = -1;
+
+    rt_mutex_take(&lock, RT_WAITING_FOREVER);
+    for(auto i = 0; i < slots; i++) {
+        if(at24cxx_read(at24_dev, addr + i * slotSize, buf, slotSize) != RT_EOK)
+            continue;
+        if(header->crc != crcOf(buf, payloadSize))
+            continue;
+        //环里序号相差不会超过槽位数, 按有符号差值比较即可跨过回绕
+        if(newest < 0 || (rt_int16_t)(header->seq - seq) > 0) {
+            newest = i;
+            seq = header->seq;
+            rt_memcpy(payload, buf + sizeof(Header), payloadSize);
+        }
+    }
+    next = newest < 0 ? 0 : (newest + 1) % slots;
+    if(newest < 0)
+        seq = 0;
+    rt_mutex_release(&lock);
+
+    LOG_D("[%d] recovered slot %d, seq %d", addr, newest, seq);
+    return newest >= 0;
+}
+
+rt_err_t EeLog::append(const void* payload) {
+    rt_uint8_t buf[EE_LOG_SLOT_MAX];
+    auto header = (Header*)buf;
+
+    rt_mutex_take(&lock, RT_WAITING_FOREVER);
+    rt_memset(buf, 0, slotSize);
+    header->seq = seq + 1;
+    rt_memcpy(buf + sizeof(Header), payload, payloadSize);
+    header->crc = crcOf(buf, payloadSize);
+
+    auto err = at24cxx_write(at24_dev, addr + next * slotSize, buf, slotSize);
+    if(err == RT_EOK) {
+        seq++;
+        next = (next + 1) % slots;
+    }
+    rt_mutex_release(&lock);
+    return err;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-16     imgcr       the first version
+ */
+#ifndef APPLICATIONS_EE_LOG_H_
+#define APPLICATIONS_EE_LOG_H_
+
+#include <rtthread.h>
+
+#define EE_PAGE_SIZE 8 //AT24C02的页大小, 槽位按页对齐, 一条记录的写入不会在页内回卷
+#define EE_LOG_SLOT_MAX 32
+
+//AT24上一段区域内的追加写记录环: 定长槽位, 每条带序号和CRC, 新记录总是写到最新记录的下一个槽位
+//写到一半掉电的槽位CRC不对, 恢复时被跳过, 上一条完整记录仍然有效
+struct EeLog {
+    EeLog(rt_uint16_t addr, rt_uint16_t size, rt_uint16_t payloadSize);
+
+    //扫描全部槽位一次, 把最新的有效记录读到payload, 没有有效记录时返回false
+    bool recover(void* payload);
+
+    rt_err_t append(const void* payload);
+
+private:
+    struct Header {
+        rt_uint16_t seq;
+        rt_uint16_t crc; //<- 覆盖seq和payload
+    };
+
+    static rt_uint16_t crcOf(const rt_uint8_t* slot, rt_uint16_t payloadSize);
+
+    rt_uint16_t addr, slotSize, slots, payloadSize;
+    rt_uint16_t next = 0, seq = 0;
+    struct rt_mutex lock;
+};
+
+#endif /* APPLICATIONS_EE_LOG_H_ */
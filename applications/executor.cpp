@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-04     imgcr       the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include <rthw.h>
+
+#define LOG_TAG "app.exec"
+#define LOG_LVL LOG_LVL_DBG
+#include <ulog.h>
+
+#include "executor.h"
+
+struct LaneDesc {
+    const char* name;
+    rt_uint16_t stackSize;
+    rt_uint8_t priority;
+};
+
+static const LaneDesc lane_descs[] = {
+    {"wq_ctl", 1024, 5},
+    {"wq_io", 1536, 11},
+    {"wq_bg", 1024, 13},
+};
+
+struct LaneStats {
+    rt_uint32_t submitted, coalesced, executed;
+    rt_tick_t maxWait, maxRun; //<- 提交到执行的最大等待, 单次执行的最长耗时
+};
+
+static struct rt_workqueue* lanes[(int)Lane::Count];
+static LaneStats lane_stats[(int)Lane::Count];
+
+JitterProbe lodDetectJitter(10);
+
+Job::Job(Lane lane, std::function<void()> fn): lane(lane), fn(fn) {
+    rt_work_init(&work, entry, this);
+}
+
+rt_err_t Job::submit() {
+    auto& stats = lane_stats[(int)lane];
+    rt_base_t level = rt_hw_interrupt_disable();
+    stats.submitted++;
+    rt_hw_interrupt_enable(level);
+
+    auto queue = lanes[(int)lane];
+    if(queue == RT_NULL) {
+        return -RT_ERROR;
+    }
+
+    if(!(work.flags & RT_WORK_STATE_PENDING)) {
+        submitTick = rt_tick_get();
+    }
+    auto err = rt_workqueue_dowork(queue, &work);
+    if(err == -RT_EBUSY) {
+        level = rt_hw_interrupt_disable();
+        stats.coalesced++;
+        rt_hw_interrupt_enable(level);
+    }
+    return err;
+}
+
+void Job::entry(struct rt_work* work, void* data) {
+    auto self = (Job*)data;
+    auto& stats = lane_stats[(int)self->lane];
+    auto begin = rt_tick_get();
+    auto wait = begin - self->submitTick;
+
+    self->fn();
+
+    auto run = rt_tick_get() - begin;
+    rt_base_t level = rt_hw_interrupt_disable();
+    stats.executed++;
+    if(wait > stats.maxWait) stats.maxWait = wait;
+    if(run > stats.maxRun) stats.maxRun = run;
+    rt_hw_interrupt_enable(level);
+}
+
+static int init_executor() {
+    for(auto i = 0; i < (int)Lane::Count; i++) {
+        auto& desc = lane_descs[i];
+        lanes[i] = rt_workqueue_create(desc.name, desc.stackSize, desc.priority);
+        if(lanes[i] == RT_NULL) {
+            LOG_E("create %s failed", desc.name);
+            return -RT_ENOMEM;
+        }
+    }
+    return RT_EOK;
+}
+
+void exec_stats() {
+    for(auto i = 0; i < (int)Lane::Count; i++) {
+        auto& s = lane_stats[i];
+        rt_kprintf("%-8s submitted: %d, coalesced: %d, executed: %d, max wait: %dms, max run: %dms\n",
+                lane_descs[i].name, s.submitted, s.coalesced, s.executed,
+                s.maxWait * 1000 / RT_TICK_PER_SECOND, s.maxRun * 1000 / RT_TICK_PER_SECOND);
+    }
+    rt_kprintf("lod timer: %d hits, period %dms, max late %dms, max early %dms\n",
+            lodDetectJitter.count, lodDetectJitter.period * 1000 / RT_TICK_PER_SECOND,
+            lodDetectJitter.maxLate * 1000 / RT_TICK_PER_SECOND, lodDetectJitter.maxEarly * 1000 / RT_TICK_PER_SECOND);
+}
+
+INIT_COMPONENT_EXPORT(init_executor);
+MSH_CMD_EXPORT(exec_stats, show work queue lane stats)
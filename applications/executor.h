@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-04     imgcr       the first version
+ */
+#ifndef APPLICATIONS_EXECUTOR_H_
+#define APPLICATIONS_EXECUTOR_H_
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include <functional>
+
+//定时器回调中只允许提交Job, 阻塞操作都在对应的工作队列线程中完成
+enum class Lane {
+    Control, //<- 继电器/端口状态等对时延敏感的操作
+    Io, //<- 4G模块AT交互
+    Background, //<- EEPROM读写, 读卡器轮询
+    Count,
+};
+
+struct Job {
+    Job(Lane lane, std::function<void()> fn);
+
+    //已在队列中时直接合并, 返回-RT_EBUSY
+    rt_err_t submit();
+
+private:
+    static void entry(struct rt_work* work, void* data);
+
+    struct rt_work work;
+    Lane lane;
+    std::function<void()> fn;
+    rt_tick_t submitTick = 0;
+};
+
+//统计周期定时器的实际触发间隔
+struct JitterProbe {
+    JitterProbe(rt_tick_t period): period(period) { }
+
+    void hit() {
+        auto now = rt_tick_get();
+        if(count++ > 0) {
+            rt_int32_t diff = (rt_int32_t)(now - last) - (rt_int32_t)period;
+            if(diff > maxLate) maxLate = diff;
+            if(-diff > maxEarly) maxEarly = -diff;
+        }
+        last = now;
+    }
+
+    rt_tick_t period;
+    rt_tick_t last = 0;
+    rt_uint32_t count = 0;
+    rt_int32_t maxLate = 0, maxEarly = 0;
+};
+
+extern JitterProbe lodDetectJitter;
+
+#endif /* APPLICATIONS_EXECUTOR_H_ */
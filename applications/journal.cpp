@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-11     imgcr       the first version
+ */
+
+#include <rtthread.h>
+#include <board.h>
+#include <drv_flash.h>
+#include <stddef.h>
+#include "journal.h"
+
+#define LOG_TAG "journal"
+#define LOG_LVL LOG_LVL_DBG
+#include <ulog.h>
+
+#define JOURNAL_ADDR (ROM_END - JOURNAL_PAGES * FLASH_PAGE_SIZE)
+#define JOURNAL_SLOTS (JOURNAL_PAGES * FLASH_PAGE_SIZE / JOURNAL_SLOT_SIZE)
+#define JOURNAL_SLOTS_PER_PAGE (FLASH_PAGE_SIZE / JOURNAL_SLOT_SIZE)
+
+Journal journal;
+
+rt_uint32_t Journal::slotAddr(int slot) {
+    return JOURNAL_ADDR + slot * JOURNAL_SLOT_SIZE;
+}
+
+//CRC-16/CCITT, 覆盖seq之后的全部字段
+rt_uint16_t Journal::crcOf(const Slot& s) {
+    static_assert(sizeof(Slot) == JOURNAL_SLOT_SIZE, "journal slot size");
+    rt_uint16_t crc = 0xffff;
+    auto p = (const rt_uint8_t*)&s.seq;
+    auto end = (const rt_uint8_t*)(&s + 1);
+    for(; p < end; p++) {
+        if(p == (const rt_uint8_t*)&s.crc) {
+            p += sizeof(s.crc) - 1;
+            continue;
+        }
+        crc ^= (rt_uint16_t)*p << 8;
+        for(auto i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+bool Journal::readSlot(int slot, Slot& s) {
+    stm32_flash_read(slotAddr(slot), (rt_uint8_t*)&s, sizeof(s));
+    return s.seq != 0xffffffff && s.crc == crcOf(s);
+}
+
+bool Journal::isBlank(int slot) {
+    auto p = (const rt_uint32_t*)slotAddr(slot);
+    for(auto i = 0; i < JOURNAL_SLOT_SIZE / 4; i++) {
+        if(p[i] != 0xffffffff)
+            return false;
+    }
+    return true;
+}
+
+//按槽位内容重建count和tail; 环写满时head == tail, 不能靠两者是否相等判断有无记录
+void Journal::rescan() {
+    rt_uint32_t minSeq = 0xffffffff;
+    count = 0;
+    tail = -1;
+    for(auto i = 0; i < JOURNAL_SLOTS; i++) {
+        Slot s;
+        if(readSlot(i, s) && s.ack == 0xffffffff) {
+            count++;
+            if(s.seq < minSeq) {
+                minSeq = s.seq;
+                tail = i;
+            }
+        }
+    }
+    if(tail < 0)
+        tail = head;
+}
+
+rt_err_t Journal::init() {
+    rt_uint32_t maxSeq = 0;
+    int maxSlot = -1;
+
+    for(auto i = 0; i < JOURNAL_SLOTS; i++) {
+        Slot s;
+        if(!readSlot(i, s))
+            continue;
+        if(maxSlot < 0 || s.seq > maxSeq) {
+            maxSeq = s.seq;
+            maxSlot = i;
+        }
+    }
+
+    head = maxSlot < 0 ? 0 : (maxSlot + 1) % JOURNAL_SLOTS;
+    nextSeq = maxSeq + 1;
+    rescan();
+    ready = true;
+    LOG_I("%d pending, head %d, tail %d", count, head, tail);
+    return RT_EOK;
+}
+
+//进入新的一页前擦除整页, 其中尚未确认的记录视为丢失
+void Journal::eraseFor(int slot) {
+    auto page = slot / JOURNAL_SLOTS_PER_PAGE;
+    auto first = page * JOURNAL_SLOTS_PER_PAGE;
+
+    auto dropped = 0;
+    for(auto i = first; i < first + JOURNAL_SLOTS_PER_PAGE; i++) {
+        Slot s;
+        if(readSlot(i, s) && s.ack == 0xffffffff)
+            dropped++;
+    }
+    stm32_flash_erase(slotAddr(first), FLASH_PAGE_SIZE);
+
+    if(dropped > 0) {
+        LOG_W("journal full, %d records dropped", dropped);
+        lost += dropped;
+        count = count > dropped ? count - dropped : 0;
+    }
+    if(tail / JOURNAL_SLOTS_PER_PAGE == page) {
+        tail = (first + JOURNAL_SLOTS_PER_PAGE) % JOURNAL_SLOTS;
+    }
+    if(count == 0)
+        tail = slot;
+}
+
+rt_err_t Journal::append(const JournalRecord& rec) {
+    if(!ready)
+        return -RT_ERROR;
+
+    //跳过掉电时写了一半的槽位
+    for(auto tries = 0; !isBlank(head); tries++) {
+        if(head % JOURNAL_SLOTS_PER_PAGE == 0 || tries >= JOURNAL_SLOTS_PER_PAGE) {
+            eraseFor(head);
+            break;
+        }
+        head = (head + 1) % JOURNAL_SLOTS;
+    }
+
+    Slot s;
+    s.ack = 0xffffffff;
+    s.seq = nextSeq;
+    s.kind = rec.kind;
+    s.port = rec.port;
+    s.value = rec.value;
+    rt_memcpy(s.text, rec.text, sizeof(s.text));
+    s.crc = crcOf(s);
+
+    //ack字保持擦除状态, 从seq开始写
+    auto off = offsetof(Slot, seq);
+    if(stm32_flash_write(slotAddr(head) + off, (const rt_uint8_t*)&s + off, sizeof(s) - off) < 0) {
+        LOG_E("journal write failed at %d", head);
+        head = (head + 1) % JOURNAL_SLOTS;
+        return -RT_EIO;
+    }
+
+    if(count == 0)
+        tail = head;
+    count++;
+    nextSeq++;
+    head = (head + 1) % JOURNAL_SLOTS;
+    return RT_EOK;
+}
+
+int Journal::peek(JournalRecord& rec) {
+    if(!ready || count == 0)
+        return -1;
+
+    for(auto n = 0; n < JOURNAL_SLOTS; n++) {
+        Slot s;
+        if(readSlot(tail, s) && s.ack == 0xffffffff) {
+            rec.kind = s.kind;
+            rec.port = s.port;
+            rec.value = s.value;
+            rt_memcpy(rec.text, s.text, sizeof(rec.text));
+            return tail;
+        }
+        tail = (tail + 1) % JOURNAL_SLOTS;
+    }
+    //转了一圈都没有未确认的记录, 说明count与flash不一致, 以flash为准
+    rescan();
+    return -1;
+}
+
+rt_err_t Journal::ack(int slot) {
+    rt_uint32_t zero = 0;
+    if(stm32_flash_write(slotAddr(slot), (const rt_uint8_t*)&zero, sizeof(zero)) < 0)
+        return -RT_EIO;
+    if(count > 0)
+        count--;
+    if(slot == tail)
+        tail = (tail + 1) % JOURNAL_SLOTS;
+    return RT_EOK;
+}
+
+static int init_journal() {
+    return journal.init();
+}
+
+void journal_stat() {
+    rt_kprintf("pending: %d, lost: %d\n", journal.size(), journal.getLost());
+}
+
+INIT_APP_EXPORT(init_journal);
+MSH_CMD_EXPORT(journal_stat, show offline journal status)
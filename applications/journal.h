@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-11     imgcr       the first version
+ */
+#ifndef APPLICATIONS_JOURNAL_H_
+#define APPLICATIONS_JOURNAL_H_
+
+#include <rtthread.h>
+
+#define JOURNAL_PAGES 2 //占用片内flash末尾的页数, 链接脚本中ROM已相应缩小
+#define JOURNAL_SLOT_SIZE 32
+#define JOURNAL_BATCH 4 //重连后每批补发的记录数
+
+//断网期间需要补发的上报, 与发送队列中的消息一一对应
+struct JournalRecord {
+    rt_uint8_t kind;
+    rt_uint8_t port;
+    rt_int32_t value;
+    char text[16];
+};
+
+//片内flash上的环形日志: 定长槽位, 每条带序号和CRC, 发送成功后将ack字清零
+//擦除页时CPU取指会停顿几十毫秒, 只在环绕到一页开头时发生
+struct Journal {
+    rt_err_t init();
+
+    //空间不足时覆盖最早的一页
+    rt_err_t append(const JournalRecord& rec);
+
+    //取最早一条未确认的记录, 返回槽位号, 没有记录时返回-1
+    int peek(JournalRecord& rec);
+
+    rt_err_t ack(int slot);
+
+    int size() {
+        return count;
+    }
+
+    rt_uint32_t getLost() {
+        return lost;
+    }
+
+private:
+    struct Slot {
+        rt_uint32_t ack; //<- 0xffffffff未确认, 0已发送
+        rt_uint32_t seq; //<- 0xffffffff为空槽
+        rt_uint16_t crc;
+        rt_uint8_t kind;
+        rt_uint8_t port;
+        rt_int32_t value;
+        char text[16];
+    };
+
+    rt_uint32_t slotAddr(int slot);
+    bool readSlot(int slot, Slot& s);
+    bool isBlank(int slot);
+    void eraseFor(int slot);
+    void rescan();
+    static rt_uint16_t crcOf(const Slot& s);
+
+    bool ready = false;
+    int head = 0, tail = 0, count = 0;
+    rt_uint32_t nextSeq = 1;
+    rt_uint32_t lost = 0;
+};
+
+extern Journal journal;
+
+#endif /* APPLICATIONS_JOURNAL_H_ */
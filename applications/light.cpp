@@ -9,9 +9,15 @@
  */
 
 #include "light.h"
+#include "ports.h"
+#include "wheel.h"
 #include <stm32f1xx_hal.h>
 
-Light light1(LIGHT1_R_PIN, LIGHT1_G_PIN, LIGHT1_B_PIN), light2(LIGHT2_R_PIN, LIGHT2_G_PIN, LIGHT2_B_PIN);
+static WheelTimer lightTimer([](auto p) {
+    for(auto& port: ports) {
+        port.light.step();
+    }
+}, RT_NULL, 100, true);
 
 //JTAG模式设置,用于设置JTAG的模式
 //mode:jtag,swd模式设置;00,全使能;01,使能SWD;10,全关闭;
@@ -30,8 +36,10 @@ void JTAG_Set(rt_uint8_t mode)
 
 int init_light() {
     JTAG_Set(0b01);
-    light1.init();
-    light2.init();
+    for(auto& p: ports) {
+        p.light.init();
+    }
+    lightTimer.start();
     return RT_EOK;
 }
 
@@ -13,13 +13,25 @@
 #include <rtthread.h>
 #include <rtdevice.h>
 
+#ifndef LIGHT1_R_PIN
 #define LIGHT1_R_PIN 15
+#endif
+#ifndef LIGHT1_G_PIN
 #define LIGHT1_G_PIN 12
+#endif
+#ifndef LIGHT1_B_PIN
 #define LIGHT1_B_PIN 11
+#endif
 
+#ifndef LIGHT2_R_PIN
 #define LIGHT2_R_PIN 21
+#endif
+#ifndef LIGHT2_G_PIN
 #define LIGHT2_G_PIN 20
+#endif
+#ifndef LIGHT2_B_PIN
 #define LIGHT2_B_PIN 19
+#endif
 
 struct Light {
 
@@ -37,55 +49,53 @@ struct Light {
         rt_pin_mode(rPin, PIN_MODE_OUTPUT);
         rt_pin_mode(bPin, PIN_MODE_OUTPUT);
         rt_pin_mode(gPin, PIN_MODE_OUTPUT);
+    }
 
-        timer = rt_timer_create("LT", [](auto p){
-            auto self = (Light*)p;
-            self->period++;
-            switch(self->state) {
-                case State::LoadButNotPay:
-                    rt_pin_write(self->gPin, PIN_LOW);
-                    rt_pin_write(self->bPin, PIN_LOW);
-
-                    if(self->period % 2) {
-                        rt_pin_write(self->rPin, PIN_HIGH);
-                    } else {
-                        rt_pin_write(self->rPin, PIN_LOW);
-                    }
-                    break;
-                case State::LoadAndPaid:
-                    rt_pin_write(self->gPin, PIN_LOW);
-                    rt_pin_write(self->bPin, PIN_LOW);
-                    rt_pin_write(self->bPin, PIN_HIGH);
-                    break;
-                case State::Charged:
-                    rt_pin_write(self->rPin, PIN_LOW);
-                    rt_pin_write(self->bPin, PIN_LOW);
-
-                    if(self->period % 2) {
-                        rt_pin_write(self->gPin, PIN_HIGH);
-                    } else {
-                        rt_pin_write(self->gPin, PIN_LOW);
-                    }
-                    break;
-                case State::LoadNotReady:
-                    rt_pin_write(self->rPin, PIN_LOW);
-                    rt_pin_write(self->bPin, PIN_LOW);
-                    rt_pin_write(self->gPin, PIN_HIGH);
-                    break;
-                case State::Error:
-                    rt_pin_write(self->bPin, PIN_LOW);
-                    if(self->period % 2) {
-                        rt_pin_write(self->rPin, PIN_HIGH);
-                        rt_pin_write(self->gPin, PIN_LOW);
-                    } else {
-                        rt_pin_write(self->rPin, PIN_LOW);
-                        rt_pin_write(self->gPin, PIN_HIGH);
-                    }
-                    break;
-            }
-
-        }, this, 100, RT_TIMER_FLAG_PERIODIC | RT_TIMER_FLAG_SOFT_TIMER);
-        rt_timer_start(timer);
+    //由所有灯共用的100ms定时器调用
+    void step() {
+        period++;
+        switch(state) {
+            case State::LoadButNotPay:
+                rt_pin_write(gPin, PIN_LOW);
+                rt_pin_write(bPin, PIN_LOW);
+
+                if(period % 2) {
+                    rt_pin_write(rPin, PIN_HIGH);
+                } else {
+                    rt_pin_write(rPin, PIN_LOW);
+                }
+                break;
+            case State::LoadAndPaid:
+                rt_pin_write(gPin, PIN_LOW);
+                rt_pin_write(bPin, PIN_LOW);
+                rt_pin_write(bPin, PIN_HIGH);
+                break;
+            case State::Charged:
+                rt_pin_write(rPin, PIN_LOW);
+                rt_pin_write(bPin, PIN_LOW);
+
+                if(period % 2) {
+                    rt_pin_write(gPin, PIN_HIGH);
+                } else {
+                    rt_pin_write(gPin, PIN_LOW);
+                }
+                break;
+            case State::LoadNotReady:
+                rt_pin_write(rPin, PIN_LOW);
+                rt_pin_write(bPin, PIN_LOW);
+                rt_pin_write(gPin, PIN_HIGH);
+                break;
+            case State::Error:
+                rt_pin_write(bPin, PIN_LOW);
+                if(period % 2) {
+                    rt_pin_write(rPin, PIN_HIGH);
+                    rt_pin_write(gPin, PIN_LOW);
+                } else {
+                    rt_pin_write(rPin, PIN_LOW);
+                    rt_pin_write(gPin, PIN_HIGH);
+                }
+                break;
+        }
     }
 
     void setState(State state) {
@@ -93,12 +103,10 @@ struct Light {
     }
 
     State state = State::LoadNotReady;
-    rt_timer_t timer;
     int period = 0;
     rt_base_t rPin, gPin, bPin;
 };
 
-extern Light light1, light2;
 
 
 #endif /* APPLICATIONS_LIGHT_H_ */
@@ -22,53 +22,85 @@ extern "C" {
 #include <string.h>
 #include <stdlib.h>
 
+#ifndef PORT_STATE_I2C_BUS
+#define PORT_STATE_I2C_BUS "i2c1"
+#endif
+
 at24cxx_device_t at24_dev;
 
 
 int init_port_state_xx() {
-    at24_dev = at24cxx_init("i2c1", 0);
+    at24_dev = at24cxx_init(PORT_STATE_I2C_BUS, 0);
     return RT_EOK;
 }
 
-void PortState::init() {
-    timer = rt_timer_create("PS", [](auto p) {
-        auto self = (PortState*)p;
-        if(self->leftSeconds > 0) {
-            LOG_I("[%d] left: %d", self->getPort(), self->leftSeconds);
-            self->leftSeconds--;
-            if(self->leftSeconds == 0) {
-                LOG_I("done");
-                if(self->onInternalChargeOverCb) {
-                    self->onInternalChargeOverCb();
-                }
+void PortState::tick() {
+    if(leftSeconds > 0) {
+        LOG_I("[%d] left: %d", getPort(), leftSeconds);
+        leftSeconds--;
+        if(charging)
+            chargeSeconds++;
+        if(leftSeconds == 0) {
+            LOG_I("done");
+            if(onInternalChargeOverCb) {
+                onInternalChargeOverCb(StopReason::Timeout);
             }
         }
-        self->saveTickCnt++;
-        self->saveTickCnt %= 60; //*10
-        if(self->saveTickCnt == 0) {
-            //SAVING DATA
-            self->save();
-        }
-    }, this, 1000, RT_TIMER_FLAG_PERIODIC | RT_TIMER_FLAG_SOFT_TIMER);
-    rt_timer_start(timer);
+    }
+    saveTickCnt++;
+    saveTickCnt %= 60; //*10
+    if(saveTickCnt == 0) {
+        //只更新portStore中的快照, EEPROM写入由它合并后在Background线程完成
+        save();
+    }
+}
+
+
+//阈值与阈值+迟滞之间保持计数不变, 避免电流在阈值附近抖动时反复清零
+void PortState::feedCurrent(float current) {
+    if(!charging || leftSeconds <= 0 || chargeSeconds < CHARGE_START_GRACE) {
+        lowSeconds = 0;
+        return;
+    }
+
+    if(current < CURRENT_THRESHOLD) {
+        lowSeconds++;
+    } else if(current > CURRENT_THRESHOLD + CHARGE_END_HYSTERESIS) {
+        lowSeconds = 0;
+    }
 
+    if(lowSeconds >= CHARGE_END_HOLD) {
+        LOG_I("[%d] current %d below %d for %ds, charge completed", portNum, int(current), CURRENT_THRESHOLD, lowSeconds);
+        lowSeconds = 0;
+        if(onInternalChargeOverCb) {
+            onInternalChargeOverCb(StopReason::CurrentLow);
+        }
+    }
 }
 
+const char* PortState::reasonName(StopReason reason) {
+    switch(reason) {
+        case StopReason::CurrentLow:
+            return "current_low";
+        default:
+            return "timeout";
+    }
+}
 
-void PortState::save() {
-    Serialized s = {
+void PortState::save(bool urgent) {
+    PortRecord rec = {
         timerId: timerId,
         leftSeconds: leftSeconds,
         charging: charging,
     };
-    LOG_I("[%d] saving", portNum);
-    at24cxx_write(at24_dev, sizeof(Serialized) * portNum, (uint8_t*)&s, sizeof(Serialized));
-    LOG_I("[%d] saved", portNum);
+    portStore.update(portNum, rec, urgent);
 }
 
 void PortState::resume() {
-    Serialized s;
-    at24cxx_read(at24_dev, sizeof(Serialized) * portNum, (uint8_t*)&s, sizeof(Serialized));
+    PortRecord s;
+    if(!portStore.resume(portNum, s)) {
+        LOG_W("[%d] no saved state", portNum);
+    }
     timerId = s.timerId;
     leftSeconds = s.leftSeconds;
     charging = s.charging;
@@ -79,6 +111,8 @@ void PortState::resume() {
             charging = 0;
         }
     }
+    //继电器重新闭合后充电器同样需要重新起振
+    chargeSeconds = lowSeconds = 0;
 
     LOG_I("[%d] resumed{timerId: %d, leftSeconds: %d, charging: %d}", portNum, timerId, leftSeconds, charging);
 }
@@ -16,6 +16,16 @@ extern "C" {
 }
 
 #include <functional>
+#include "executor.h"
+#include "port_store.h"
+
+#ifndef CURRENT_THRESHOLD
+#define CURRENT_THRESHOLD 50 //充电电流低于此值认为已充满, 与上报的current同单位
+#endif
+#define CHARGE_END_HYSTERESIS 20 //电流回升到阈值+迟滞以上才重新计时
+#define CHARGE_END_HOLD 180 //低电流持续多久后结束充电(s)
+#define CHARGE_START_GRACE 60 //开始充电后多久内不判断, 等待充电器进入恒流阶段(s)
+#define CHARGE_SAMPLE_AGE 3000 //计量快照超过此时间(ms)不再用于判断
 
 extern at24cxx_device_t at24_dev;
 
@@ -28,9 +38,15 @@ struct PortState {
         Error,
     };
 
-    PortState(int portNum): portNum(portNum) { }
+    //只用于本地结束的充电; 平台下发的停止由平台自己记录, 不回报原因
+    enum class StopReason {
+        Timeout, //<- 本地计时结束
+        CurrentLow, //<- 电流持续低于阈值, 判定已充满
+    };
 
-    void init();
+    static const char* reasonName(StopReason reason);
+
+    PortState(int portNum): portNum(portNum) { }
 
     Value get() {
         if(_loadInserted) {
@@ -80,7 +96,8 @@ struct PortState {
         this->leftSeconds = minutes * 60;
         this->timerId = timerId;
         charging = true;
-        save();
+        chargeSeconds = lowSeconds = 0;
+        save(true);
     }
 
     void stopCharging(int timerId) {
@@ -88,7 +105,7 @@ struct PortState {
         //this->timerId = 0;
         charging = false;
         leftSeconds = 0;
-        save();
+        save(true);
     }
 
 
@@ -112,17 +129,12 @@ struct PortState {
 
     }
 
-    void onInternalChargeOver(std::function<void()> cb) {
+    void onInternalChargeOver(std::function<void(StopReason reason)> cb) {
         onInternalChargeOverCb = cb;
     }
 
-    struct Serialized {
-        int timerId;
-        int leftSeconds;
-        bool charging;
-    };
-
-    void save();
+    //交给portStore合并写入, urgent时立即落盘
+    void save(bool urgent = false);
 
     void resume();
 
@@ -130,16 +142,23 @@ struct PortState {
         onResumePortOpenRequiredCb = cb;
     }
 
+    //每秒由ports.cpp中的定时Job调用一次
+    void tick();
+
+    //紧跟tick()之后传入本端口最新的电流, 计量数据不可用时不调用
+    void feedCurrent(float current);
+
 private:
+
     int timerId = 0;
     int portNum;
     int leftSeconds = 0;
     bool _loadInserted = false;
     bool charging = false;
     int saveTickCnt = 0;
+    int chargeSeconds = 0, lowSeconds = 0;
     rt_tick_t lastInsertTick = 0;
-    std::function<void()> onInternalChargeOverCb;
-    rt_timer_t timer;
+    std::function<void(StopReason reason)> onInternalChargeOverCb;
     std::function<bool()> onResumePortOpenRequiredCb;
 };
 
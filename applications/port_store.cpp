@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-17     imgcr       the first version
+ */
+
+#include <rtthread.h>
+#include "port_store.h"
+
+#define LOG_TAG "ps.store"
+#define LOG_LVL LOG_LVL_DBG
+#include <ulog.h>
+
+PortStore portStore;
+
+PortStore::PortStore(): log(PORT_STORE_EE_ADDR, PORT_STORE_EE_SIZE, sizeof(PackedSnapshot)),
+    flushJob(Lane::Background, [this] { flush(); }),
+    timer([](auto p) {
+        auto self = (PortStore*)p;
+        self->flushJob.submit();
+    }, this, PORT_STORE_LATENCY, false) {
+    rt_memset(&staged, 0, sizeof(staged));
+    rt_mutex_init(&lock, "ps_store", RT_IPC_FLAG_FIFO);
+}
+
+void PortStore::pack(const Snapshot& from, PackedSnapshot& to) {
+    for(auto i = 0; i < PORT_COUNT; i++) {
+        auto& rec = from.ports[i];
+        auto& out = to.ports[i];
+        auto left = rec.charging && rec.leftSeconds > 0 ? rec.leftSeconds : 0;
+        out.timerId[0] = (rt_uint32_t)rec.timerId & 0xffff;
+        out.timerId[1] = (rt_uint32_t)rec.timerId >> 16;
+        if(left < 0x8000) {
+            out.left = left;
+        } else {
+            auto minutes = (left + 59) / 60;
+            out.left = 0x8000 | (minutes < 0x7fff ? minutes : 0x7fff);
+        }
+    }
+}
+
+void PortStore::unpack(const PackedSnapshot& from, Snapshot& to) {
+    for(auto i = 0; i < PORT_COUNT; i++) {
+        auto& in = from.ports[i];
+        auto& rec = to.ports[i];
+        rec.timerId = (int)((rt_uint32_t)in.timerId[0] | (rt_uint32_t)in.timerId[1] << 16);
+        rec.leftSeconds = (in.left & 0x8000) ? (in.left & 0x7fff) * 60 : in.left;
+        rec.charging = rec.leftSeconds > 0;
+    }
+}
+
+void PortStore::load() {
+    PackedSnapshot packed;
+    recovered = log.recover(&packed);
+    if(recovered) {
+        unpack(packed, staged);
+    } else {
+        LOG_W("no saved state");
+        rt_memset(&staged, 0, sizeof(staged));
+    }
+    loaded = true;
+}
+
+bool PortStore::resume(int port, PortRecord& rec) {
+    RT_ASSERT(port >= 1 && port <= PORT_COUNT);
+    rt_mutex_take(&lock, RT_WAITING_FOREVER);
+    if(!loaded)
+        load();
+    rec = staged.ports[port - 1];
+    rt_mutex_release(&lock);
+    return recovered;
+}
+
+void PortStore::update(int port, const PortRecord& rec, bool urgent) {
+    RT_ASSERT(port >= 1 && port <= PORT_COUNT);
+    rt_mutex_take(&lock, RT_WAITING_FOREVER);
+    stats.updates++;
+    auto& cur = staged.ports[port - 1];
+    if(cur.timerId == rec.timerId && cur.leftSeconds == rec.leftSeconds && cur.charging == rec.charging) {
+        stats.unchanged++;
+    } else {
+        cur.timerId = rec.timerId;
+        cur.leftSeconds = rec.leftSeconds;
+        cur.charging = rec.charging;
+        dirty = true;
+    }
+    auto pending = dirty;
+    if(pending && urgent)
+        stats.urgent++;
+    rt_mutex_release(&lock);
+
+    if(!pending)
+        return;
+    if(urgent) {
+        flush();
+    } else if(!timer.isActive()) {
+        timer.start();
+    }
+}
+
+void PortStore::flush() {
+    rt_mutex_take(&lock, RT_WAITING_FOREVER);
+    timer.stop();
+    if(!dirty) {
+        rt_mutex_release(&lock);
+        return;
+    }
+
+    PackedSnapshot packed;
+    pack(staged, packed);
+    auto begin = rt_tick_get();
+    auto err = log.append(&packed);
+    auto busy = rt_tick_get() - begin;
+
+    stats.busy += busy;
+    if(busy > stats.maxBusy)
+        stats.maxBusy = busy;
+    if(err == RT_EOK) {
+        stats.flushes++;
+        dirty = false;
+    } else {
+        stats.failed++;
+        LOG_E("flush failed(%d)", err);
+        timer.start();
+    }
+    rt_mutex_release(&lock);
+}
+
+void PortStore::printStats() {
+    rt_kprintf("updates: %d, unchanged: %d, flushes: %d, urgent: %d, failed: %d\n",
+            stats.updates, stats.unchanged, stats.flushes, stats.urgent, stats.failed);
+    rt_kprintf("i2c busy: %dms, max: %dms, dirty: %d\n",
+            stats.busy * 1000 / RT_TICK_PER_SECOND, stats.maxBusy * 1000 / RT_TICK_PER_SECOND, dirty);
+}
+
+void port_store_stats() {
+    portStore.printStats();
+}
+
+MSH_CMD_EXPORT(port_store_stats, show port state persistence stats)
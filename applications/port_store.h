@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-17     imgcr       the first version
+ */
+#ifndef APPLICATIONS_PORT_STORE_H_
+#define APPLICATIONS_PORT_STORE_H_
+
+#include <rtthread.h>
+#include "executor.h"
+#include "ee_log.h"
+#include "wheel.h"
+
+#ifndef PORT_COUNT
+#define PORT_COUNT 2 //柜体端口数, 接线见ports.cpp中的port_descs
+#endif
+#define PORT_STORE_EE_ADDR 0 //端口状态记录环在AT24中的起始位置
+#define PORT_STORE_EE_SIZE 128 //之后是iotToken
+#define PORT_STORE_SLOT_SIZE 16 //两页一个槽位, 128字节共8个槽位, 每页每8次写入才轮到一次
+#ifndef PORT_STORE_LATENCY
+#define PORT_STORE_LATENCY 5000 //普通更新最多延迟多久写入(ms), 期间其它端口的更新合并到同一次写入
+#endif
+
+struct PortRecord {
+    int timerId;
+    int leftSeconds;
+    bool charging;
+};
+
+//收集所有端口的状态, 合并成一条快照写入AT24上的记录环; 两个端口的快照连同记录头共16字节, 每次写入两页
+//计费相关的变化(开始/停止充电)调用方要求立即写入, 在调用线程中同步完成
+struct PortStore {
+    PortStore();
+
+    //port从1开始, 记录环中没有有效快照时返回false, 首次调用时扫描一遍记录环
+    bool resume(int port, PortRecord& rec);
+
+    //与已暂存的内容相同时忽略
+    void update(int port, const PortRecord& rec, bool urgent);
+
+    void flush();
+
+    void printStats();
+
+private:
+    struct Snapshot {
+        PortRecord ports[PORT_COUNT];
+    };
+
+    //AT24上的紧凑格式, 每端口6字节; charging不单独保存, 落盘时总与leftSeconds > 0一致
+    struct PackedPort {
+        rt_uint16_t timerId[2]; //<- 低16位在前, 拆开存放避免4字节对齐的填充
+        rt_uint16_t left; //<- 最高位为0时单位为秒, 为1时为分钟(向上取整), 超过9小时的计时恢复后最多多出1分钟
+    };
+
+    struct PackedSnapshot {
+        PackedPort ports[PORT_COUNT];
+    };
+
+    //端口更多时槽位变大, 记录环的槽位数和寿命都要重新核算
+    static_assert(RT_ALIGN(sizeof(rt_uint32_t) + sizeof(PackedSnapshot), EE_PAGE_SIZE) <= PORT_STORE_SLOT_SIZE, "port snapshot too large");
+
+    static void pack(const Snapshot& from, PackedSnapshot& to);
+    static void unpack(const PackedSnapshot& from, Snapshot& to);
+
+    struct Stats {
+        rt_uint32_t updates, unchanged, flushes, urgent, failed;
+        rt_tick_t busy, maxBusy; //<- I2C写入的累计耗时和单次最长耗时
+    };
+
+    void load();
+
+    EeLog log;
+    Snapshot staged;
+    bool loaded = false, recovered = false, dirty = false;
+    Stats stats = {};
+    struct rt_mutex lock;
+    Job flushJob;
+    WheelTimer timer;
+};
+
+extern PortStore portStore;
+
+#endif /* APPLICATIONS_PORT_STORE_H_ */
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-18     imgcr       the first version
+ */
+
+#include <rtthread.h>
+#include "ports.h"
+#include "executor.h"
+#include "wheel.h"
+
+#define LOG_TAG "ports"
+#define LOG_LVL LOG_LVL_DBG
+#include <ulog.h>
+
+//电流通道与端口号反接
+const PortDesc port_descs[PORT_COUNT] = {
+    {
+        detectPin: PORTA_DETECT_PIN,
+        relayPin: RELAY1_PIN,
+        lightR: LIGHT1_R_PIN, lightG: LIGHT1_G_PIN, lightB: LIGHT1_B_PIN,
+        channel: Hlw::B,
+        pluged: VoiceFrg::PortAPluged, unpluged: VoiceFrg::PortAUnpluged,
+    },
+    {
+        detectPin: PORTB_DETECT_PIN,
+        relayPin: RELAY2_PIN,
+        lightR: LIGHT2_R_PIN, lightG: LIGHT2_G_PIN, lightB: LIGHT2_B_PIN,
+        channel: Hlw::A,
+        pluged: VoiceFrg::PortBPluged, unpluged: VoiceFrg::PortBUnpluged,
+    },
+};
+
+Ports ports;
+
+//所有端口共用一个秒定时器, 在同一个Job中依次计时并判断是否已充满
+//计量降级或快照过旧时只计时, 不用旧数据断电
+static Job tickJob(Lane::Control, [] {
+    Hlw::Snapshot snap;
+    bool fresh = hlw.latest(snap) && !hlw.getHealth().degraded
+            && Hlw::getAge(snap) < rt_tick_from_millisecond(CHARGE_SAMPLE_AGE);
+    for(auto& p: ports) {
+        p.state.tick();
+        if(fresh) {
+            p.state.feedCurrent(snap.m.i(p.desc.channel));
+        }
+    }
+});
+
+static WheelTimer tickTimer([](auto p) {
+    tickJob.submit();
+}, RT_NULL, 1000, true);
+
+static int init_ports() {
+    tickTimer.start();
+    return RT_EOK;
+}
+
+INIT_APP_EXPORT(init_ports);
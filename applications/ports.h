@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-18     imgcr       the first version
+ */
+#ifndef APPLICATIONS_PORTS_H_
+#define APPLICATIONS_PORTS_H_
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include <cstddef>
+#include <utility>
+#include "port_state.h"
+#include "state.h"
+#include "light.h"
+#include "relay.h"
+#include "wtn6.h"
+
+//端口的硬件接线, 表在ports.cpp中, 端口号为下标+1, 也是portStore快照中的位置+1
+struct PortDesc {
+    rt_base_t detectPin;
+    rt_base_t relayPin;
+    rt_base_t lightR, lightG, lightB;
+    Hlw::Port channel; //<- HLW8112上的电流通道
+    VoiceFrg pluged, unpluged;
+};
+
+extern const PortDesc port_descs[PORT_COUNT];
+
+struct Port {
+    Port(int num): desc(port_descs[num - 1]), state(num), detect(desc.detectPin),
+        light(desc.lightR, desc.lightG, desc.lightB) { }
+
+    void relay(bool on) {
+        relay_ctl(desc.relayPin, on ? PIN_HIGH : PIN_LOW);
+    }
+
+    int num() {
+        return state.getPort();
+    }
+
+    const PortDesc& desc;
+    PortState state;
+    LodDetect detect;
+    Light light;
+};
+
+template<class Seq>
+struct PortTable;
+
+//按PORT_COUNT展开成{{1}, {2}, ...}, 端口对象在原地构造
+template<std::size_t... I>
+struct PortTable<std::index_sequence<I...>> {
+    Port items[sizeof...(I)] = {{int(I) + 1}...};
+
+    Port* begin() {
+        return items;
+    }
+
+    Port* end() {
+        return items + sizeof...(I);
+    }
+
+    //端口号从1开始, 越界返回nullptr
+    Port* get(int num) {
+        return num >= 1 && num <= (int)sizeof...(I) ? &items[num - 1] : nullptr;
+    }
+};
+
+using Ports = PortTable<std::make_index_sequence<PORT_COUNT>>;
+
+extern Ports ports;
+
+#endif /* APPLICATIONS_PORTS_H_ */
@@ -11,6 +11,9 @@
 //#include "mfrc522.h"
 #include "rc522.h"
 #include "string.h"
+#include "executor.h"
+#include "wheel.h"
+#include "rc522_transport.h"
 
 #define LOG_TAG "app.522"
 #define LOG_LVL LOG_LVL_DBG
@@ -38,11 +41,11 @@ unsigned char status;
 unsigned char s=0x08;
 
 
-#define   RC522_DELAY()  rt_hw_us_delay(50)
 #define delay_us rt_hw_us_delay
 #define delay_ms rt_thread_mdelay
 
 Rc522 rc522;
+static Rc522Transport* transport;
 
 void RC522_Handel(void)
 {
@@ -84,13 +87,19 @@ void RC522_Handel(void)
 }
 
 
-rt_timer_t rc522_timer;
 rt_uint32_t sn_prev = 0;
 rt_tick_t last_tick;
 
-int i = 0;
+#ifdef RC522_IRQ_PIN
+static rt_event_t rc522_event;
+#endif
+
+//只需卡号: 寻卡+防冲撞后即结束, 不再选卡/认证/读块
+//无卡时关闭天线, 仅在每次寻卡前短暂打开
 void rc522_timer_cb(void* p) {
-   i++;
+   PcdAntennaOn();
+   delay_ms(RC522_ANTENNA_SETTLE);
+
    status = PcdRequest(PICC_REQALL,CT);//寻卡
    if(status==MI_OK)// 寻卡成功
    {
@@ -98,51 +107,42 @@ void rc522_timer_cb(void* p) {
        status = PcdAnticoll(SN);// 防冲撞
    }
 
-   if (status==MI_OK)// 防冲撞成功
+   if (status!=MI_OK)
    {
-       status=MI_ERR;
-       //TODO
-       //ShowID(SN); // 串口打印卡的ID号
-
-       //LOG_D("%02x%02x%02x%02x, tick=%d, last_tick=%d", SN[0], SN[1], SN[2], SN[3], rt_tick_get(), last_tick);
-//       if(rc522.onCardInsertedCb) {
-//           rc522.onCardInsertedCb(*(uint32_t*)SN);
-//       }
-
-       if(sn_prev != *(rt_uint32_t*)SN || (sn_prev == *(rt_uint32_t*)SN && (rt_tick_get() - last_tick > 1000))) {
-           //LOG_I("%02x%02x%02x%02x", SN[0], SN[1], SN[2], SN[3]);
-           if(rc522.onCardInsertedCb) {
-              rc522.onCardInsertedCb(*(uint32_t*)SN);
-          }
-           sn_prev = *(rt_uint32_t*)SN;
-       }
-
-       last_tick = rt_tick_get();
-
-       status =PcdSelect(SN);
+       PcdAntennaOff();
+       return;
    }
 
-   if(status==MI_OK)//选卡成功
-   {
-       status=MI_ERR;
-       status =PcdAuthState(0x60,0x09,KEY,SN);
-   }
-   if(status==MI_OK)//验证成功
-   {
-       status=MI_ERR;
-       status=PcdRead(s,RFID);
+   if(sn_prev != *(rt_uint32_t*)SN || (sn_prev == *(rt_uint32_t*)SN && (rt_tick_get() - last_tick > 1000))) {
+       if(rc522.onCardInsertedCb) {
+          rc522.onCardInsertedCb(*(uint32_t*)SN);
+       }
+       sn_prev = *(rt_uint32_t*)SN;
    }
 
-   if(status==MI_OK)//读卡成功
-   {
-       status=MI_ERR;
-   }
+   last_tick = rt_tick_get();
 }
 
+//寄存器访问与等待卡片应答都会阻塞, 不能在定时器线程中执行
+static Job rc522_job(Lane::Background, [] { rc522_timer_cb(RT_NULL); });
+
+static WheelTimer rc522_timer([](auto p) {
+    rc522_job.submit();
+}, RT_NULL, RC522_PROBE_INTERVAL, true);
+
 int RC522_Init ( void )
 {
     SPI1_Init();
 
+#ifdef RC522_IRQ_PIN
+    rc522_event = rt_event_create(LOG_TAG, RT_IPC_FLAG_FIFO);
+    rt_pin_mode(RC522_IRQ_PIN, PIN_MODE_INPUT_PULLUP);
+    rt_pin_attach_irq(RC522_IRQ_PIN, PIN_IRQ_MODE_FALLING, [](void* p) {
+        rt_event_send(rc522_event, 1);
+    }, RT_NULL);
+    rt_pin_irq_enable(RC522_IRQ_PIN, PIN_IRQ_ENABLE);
+#endif
+
     RC522_Reset_Disable();
 
     RC522_CS_Disable();
@@ -151,84 +151,15 @@ int RC522_Init ( void )
 
     M500PcdConfigISOType ( 'A' );//设置工作方式
 
-    rc522_timer = rt_timer_create(LOG_TAG, rc522_timer_cb, RT_NULL, 100, RT_TIMER_FLAG_PERIODIC | RT_TIMER_FLAG_SOFT_TIMER);
-    rt_timer_start(rc522_timer);
+    rc522_timer.start();
 
     return RT_EOK;
 }
 
 void SPI1_Init(void)
 {
-    rt_pin_mode(4, PIN_MODE_OUTPUT);
-    rt_pin_mode(5, PIN_MODE_OUTPUT);
-    rt_pin_mode(6, PIN_MODE_INPUT);
-    rt_pin_mode(7, PIN_MODE_OUTPUT);
-    rt_pin_mode(8, PIN_MODE_OUTPUT);
-}
-
-
-/*
- * 函数名：SPI_RC522_SendByte
- * 描述  ：向RC522发送1 Byte 数据
- * 输入  ：byte，要发送的数据
- * 返回  : RC522返回的数据
- * 调用  ：内部调用
- */
-void SPI_RC522_SendByte ( u8 byte )
-{
-    u8 counter;
-
-    for(counter=0; counter<8; counter++)
-    {
-        if ( byte & 0x80 )
-            RC522_MOSI_1 ();
-        else
-            RC522_MOSI_0 ();
-
-        RC522_DELAY();
-
-        RC522_SCK_0 ();
-
-        RC522_DELAY();
-
-        RC522_SCK_1();
-
-        RC522_DELAY();
-
-        byte <<= 1;
-
-    }
-
-}
-
-
-/*
- * 函数名：SPI_RC522_ReadByte
- * 描述  ：从RC522发送1 Byte 数据
- * 输入  ：无
- * 返回  : RC522返回的数据
- * 调用  ：内部调用
- */
-u8 SPI_RC522_ReadByte ( void )
-{
-    u8 counter;
-    u8 SPI_Data = 0;
-
-    for(counter=0; counter<8; counter++)
-    {
-        SPI_Data <<= 1;
-        RC522_SCK_0 ();
-        RC522_DELAY();
-        if ( RC522_MISO_GET() == 1)
-            SPI_Data |= 0x01;
-        RC522_DELAY();
-        RC522_SCK_1 ();
-        RC522_DELAY();
-    }
-
-
-//  printf("****%c****",SPI_Data);
-    return SPI_Data;
+    rt_pin_mode(RC522_RST_PIN, PIN_MODE_OUTPUT);
+    transport = rc522_transport_probe();
 }
 
 
@@ -241,20 +172,7 @@ u8 SPI_RC522_ReadByte ( void )
  */
 u8 ReadRawRC ( u8 ucAddress )
 {
-    u8 ucAddr, ucReturn;
-
-
-    ucAddr = ( ( ucAddress << 1 ) & 0x7E ) | 0x80;
-
-    RC522_CS_Enable();
-
-    SPI_RC522_SendByte ( ucAddr );
-
-    ucReturn = SPI_RC522_ReadByte ();
-
-    RC522_CS_Disable();
-
-    return ucReturn;
+    return transport->read ( ucAddress );
 }
 
 
@@ -268,17 +186,7 @@ u8 ReadRawRC ( u8 ucAddress )
  */
 void WriteRawRC ( u8 ucAddress, u8 ucValue)
 {
-    u8 ucAddr;
-
-    ucAddr = ( ucAddress << 1 ) & 0x7E;
-
-    RC522_CS_Enable();
-
-    SPI_RC522_SendByte ( ucAddr );
-
-    SPI_RC522_SendByte ( ucValue );
-
-    RC522_CS_Disable();
+    transport->write ( ucAddress, ucValue );
 }
 
 
@@ -472,11 +380,13 @@ char PcdComMF522 ( u8 ucCommand, u8 * pInData, u8 ucInLenByte, u8 * pOutData, u3
 
     WriteRawRC ( ComIEnReg, ucIrqEn | 0x80 );       //IRqInv置位管脚IRQ与Status1Reg的IRq位的值相反
     ClearBitMask ( ComIrqReg, 0x80 );           //Set1该位清零时，CommIRqReg的屏蔽位清零
+#ifdef RC522_IRQ_PIN
+    rt_event_recv ( rc522_event, 1, RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, 0, RT_NULL ); //丢弃上一条命令残留的中断
+#endif
     WriteRawRC ( CommandReg, PCD_IDLE );        //写空闲命令
     SetBitMask ( FIFOLevelReg, 0x80 );          //置位FlushBuffer清除内部FIFO的读和写指针以及ErrReg的BufferOvfl标志位被清除
 
-    for ( ul = 0; ul < ucInLenByte; ul ++ )
-        WriteRawRC ( FIFODataReg, pInData [ ul ] );         //写数据进FIFOdata
+    transport->writeBurst ( FIFODataReg, pInData, ucInLenByte );         //写数据进FIFOdata
 
     WriteRawRC ( CommandReg, ucCommand );                   //写命令
 
@@ -484,6 +394,12 @@ char PcdComMF522 ( u8 ucCommand, u8 * pInData, u8 ucInLenByte, u8 * pOutData, u3
     if ( ucCommand == PCD_TRANSCEIVE )
         SetBitMask(BitFramingReg,0x80);                 //StartSend置位启动数据发送 该位与收发命令使用时才有效
 
+#ifdef RC522_IRQ_PIN
+    //IRQ脚在定时器/接收/空闲等中断发生时拉低, 期间线程挂起
+    rt_event_recv ( rc522_event, 1, RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, RC522_IRQ_TIMEOUT, RT_NULL );
+    ucN = ReadRawRC ( ComIrqReg );
+    ul = ( ( ucN & 0x01 ) || ( ucN & ucWaitFor ) ) ? 1 : 0;
+#else
     ul = 1000;//根据时钟频率调整，操作M1卡最大等待时间25ms
 
     do                                                      //认证 与寻卡等待时间
@@ -491,6 +407,7 @@ char PcdComMF522 ( u8 ucCommand, u8 * pInData, u8 ucInLenByte, u8 * pOutData, u3
         ucN = ReadRawRC ( ComIrqReg );                          //查询事件中断
         ul --;
     } while ( ( ul != 0 ) && ( ! ( ucN & 0x01 ) ) && ( ! ( ucN & ucWaitFor ) ) );       //退出条件i=0,定时器中断，与写空闲命令
+#endif
 
     ClearBitMask ( BitFramingReg, 0x80 );                   //清理允许StartSend位
 
@@ -520,8 +437,7 @@ char PcdComMF522 ( u8 ucCommand, u8 * pInData, u8 ucInLenByte, u8 * pOutData, u3
                 if ( ucN > MAXRLEN )
                     ucN = MAXRLEN;
 
-                for ( ul = 0; ul < ucN; ul ++ )
-                    pOutData [ ul ] = ReadRawRC ( FIFODataReg );
+                transport->readBurst ( FIFODataReg, pOutData, ucN );
             }
         }
         else
@@ -644,8 +560,7 @@ void CalulateCRC ( u8 * pIndata, u8 ucLen, u8 * pOutData )
 
     SetBitMask(FIFOLevelReg,0x80);
 
-    for ( uc = 0; uc < ucLen; uc ++)
-        WriteRawRC ( FIFODataReg, * ( pIndata + uc ) );
+    transport->writeBurst ( FIFODataReg, pIndata, ucLen );
 
     WriteRawRC ( CommandReg, PCD_CALCCRC );
 
@@ -160,24 +160,43 @@ void SPI1_Init(void);
 #define CLR_RC522RST  GPIOF->BRR=0X02
 
 
+/***********************RC522 引脚**********************/
+#ifndef RC522_CS_PIN
+#define RC522_CS_PIN 4 //PA4, 硬件SPI时同样作为片选
+#endif
+#ifndef RC522_SCK_PIN
+#define RC522_SCK_PIN 5
+#endif
+#ifndef RC522_MISO_PIN
+#define RC522_MISO_PIN 6
+#endif
+#ifndef RC522_MOSI_PIN
+#define RC522_MOSI_PIN 7
+#endif
+#ifndef RC522_RST_PIN
+#define RC522_RST_PIN 8
+#endif
+
 /***********************RC522 函数宏定义**********************/
-#define          RC522_CS_Enable()         rt_pin_write(4, PIN_LOW)
-#define          RC522_CS_Disable()        rt_pin_write(4, PIN_HIGH)
+#define          RC522_CS_Enable()         rt_pin_write(RC522_CS_PIN, PIN_LOW)
+#define          RC522_CS_Disable()        rt_pin_write(RC522_CS_PIN, PIN_HIGH)
 
-#define          RC522_Reset_Enable()      rt_pin_write(8, PIN_LOW)
-#define          RC522_Reset_Disable()     rt_pin_write(8, PIN_HIGH)
+#define          RC522_Reset_Enable()      rt_pin_write(RC522_RST_PIN, PIN_LOW)
+#define          RC522_Reset_Disable()     rt_pin_write(RC522_RST_PIN, PIN_HIGH)
 
-#define          RC522_SCK_0()             rt_pin_write(5, PIN_LOW)
-#define          RC522_SCK_1()             rt_pin_write(5, PIN_HIGH)
+#define          RC522_SCK_0()             rt_pin_write(RC522_SCK_PIN, PIN_LOW)
+#define          RC522_SCK_1()             rt_pin_write(RC522_SCK_PIN, PIN_HIGH)
 
-#define          RC522_MOSI_0()            rt_pin_write(7, PIN_LOW)
-#define          RC522_MOSI_1()            rt_pin_write(7, PIN_HIGH)
+#define          RC522_MOSI_0()            rt_pin_write(RC522_MOSI_PIN, PIN_LOW)
+#define          RC522_MOSI_1()            rt_pin_write(RC522_MOSI_PIN, PIN_HIGH)
 
-#define          RC522_MISO_GET()          rt_pin_read(6)
+#define          RC522_MISO_GET()          rt_pin_read(RC522_MISO_PIN)
 
 void             RC522_Handel               (void);
 int             RC522_Init                 ( void );                       //初始化
 void             PcdReset                   ( void );                       //复位
+void             PcdAntennaOn               ( void );                       //开启天线
+void             PcdAntennaOff              ( void );                       //关闭天线
 void             M500PcdConfigISOType       ( u8 type );                    //工作方式
 char             PcdRequest                 ( u8 req_code, u8 * pTagType ); //寻卡
 char             PcdAnticoll                ( u8 * pSnr);                   //读卡号
@@ -197,7 +216,14 @@ extern char* POINT_LAT_OFF;
 
 
 /***********************RC522 参数配置**********************/
+#ifndef RC522_SPI_GPIO
 #define RC522_SPI_GPIO GPIOA
+#endif
+
+//MFRC522 IRQ脚(低有效)默认不用, 查询ComIrqReg; 接了线的板卡在rtconfig.h中定义RC522_IRQ_PIN(如29)
+#define RC522_IRQ_TIMEOUT 50 //等待命令完成中断的超时(ms), 大于芯片内部定时器的超时
+#define RC522_PROBE_INTERVAL 100 //寻卡周期(ms)
+#define RC522_ANTENNA_SETTLE 5 //开天线后等待卡片上电的时间(ms)
 
 
 struct Rc522 {
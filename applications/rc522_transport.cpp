@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-06     imgcr       the first version
+ */
+
+#include <rtthread.h>
+#include <rtdevice.h>
+#include <board.h>
+#ifdef BSP_USING_SPI1
+#include <drv_spi.h>
+#endif
+
+#define LOG_TAG "app.522t"
+#define LOG_LVL LOG_LVL_DBG
+#include <ulog.h>
+
+#include "rc522.h"
+#include "rc522_transport.h"
+
+#ifdef BSP_USING_SPI1
+struct Rc522SpiTransport: public Rc522Transport {
+    rt_err_t init() override {
+        if(rt_device_find(RC522_SPI_BUS) == RT_NULL)
+            return -RT_ENOSYS;
+
+        if(rt_device_find(RC522_SPI_DEVICE) == RT_NULL) {
+            if(rt_hw_spi_device_attach(RC522_SPI_BUS, RC522_SPI_DEVICE, RC522_SPI_GPIO, RC522_SPI_CS_GPIO_PIN) != RT_EOK)
+                return -RT_ERROR;
+        }
+        dev = (struct rt_spi_device*)rt_device_find(RC522_SPI_DEVICE);
+
+        struct rt_spi_configuration cfg;
+        cfg.mode = RT_SPI_MASTER | RT_SPI_MODE_0 | RT_SPI_MSB;
+        cfg.data_width = 8;
+        cfg.max_hz = RC522_SPI_MAX_HZ;
+        return rt_spi_configure(dev, &cfg);
+    }
+
+    rt_uint8_t read(rt_uint8_t reg) override {
+        rt_uint8_t tx[2] = {readAddr(reg), 0}, rx[2];
+        rt_spi_transfer(dev, tx, rx, 2);
+        return rx[1];
+    }
+
+    void write(rt_uint8_t reg, rt_uint8_t val) override {
+        rt_uint8_t tx[2] = {writeAddr(reg), val};
+        rt_spi_send(dev, tx, 2);
+    }
+
+    //每个字节重复发送读地址, 最后一个字节发送0结束
+    void readBurst(rt_uint8_t reg, rt_uint8_t* buf, rt_uint8_t len) override {
+        rt_uint8_t tx[DEF_FIFO_LENGTH + 1], rx[DEF_FIFO_LENGTH + 1];
+        if(len > DEF_FIFO_LENGTH)
+            len = DEF_FIFO_LENGTH;
+        rt_memset(tx, readAddr(reg), len);
+        tx[len] = 0;
+        rt_spi_transfer(dev, tx, rx, len + 1);
+        rt_memcpy(buf, rx + 1, len);
+    }
+
+    void writeBurst(rt_uint8_t reg, const rt_uint8_t* buf, rt_uint8_t len) override {
+        rt_uint8_t addr = writeAddr(reg);
+        rt_spi_send_then_send(dev, &addr, 1, buf, len);
+    }
+
+    const char* name() override {
+        return RC522_SPI_BUS;
+    }
+
+private:
+    struct rt_spi_device* dev = RT_NULL;
+};
+
+static Rc522SpiTransport spi_transport;
+#endif
+
+struct Rc522BitBangTransport: public Rc522Transport {
+    rt_err_t init() override {
+        rt_pin_mode(RC522_CS_PIN, PIN_MODE_OUTPUT);
+        rt_pin_mode(RC522_SCK_PIN, PIN_MODE_OUTPUT);
+        rt_pin_mode(RC522_MISO_PIN, PIN_MODE_INPUT);
+        rt_pin_mode(RC522_MOSI_PIN, PIN_MODE_OUTPUT);
+        RC522_CS_Disable();
+
+#ifdef RT_USING_CPUTIME
+        //半周期换算为DWT周期计数, 向上取整; 没有cputime实现时getres返回0, 只靠管脚操作本身的耗时
+        auto res = clock_cpu_getres();
+        halfTicks = res > 0 ? (rt_uint32_t)(RC522_BITBANG_HALF_NS / res) + 1 : 0;
+#endif
+        return RT_EOK;
+    }
+
+    rt_uint8_t read(rt_uint8_t reg) override {
+        RC522_CS_Enable();
+        sendByte(readAddr(reg));
+        rt_uint8_t val = recvByte();
+        RC522_CS_Disable();
+        return val;
+    }
+
+    void write(rt_uint8_t reg, rt_uint8_t val) override {
+        RC522_CS_Enable();
+        sendByte(writeAddr(reg));
+        sendByte(val);
+        RC522_CS_Disable();
+    }
+
+    void readBurst(rt_uint8_t reg, rt_uint8_t* buf, rt_uint8_t len) override {
+        RC522_CS_Enable();
+        sendByte(readAddr(reg));
+        for(auto i = 0; i < len; i++) {
+            //最后一个字节发送0结束读取
+            buf[i] = transferByte(i + 1 < len ? readAddr(reg) : 0);
+        }
+        RC522_CS_Disable();
+    }
+
+    void writeBurst(rt_uint8_t reg, const rt_uint8_t* buf, rt_uint8_t len) override {
+        RC522_CS_Enable();
+        sendByte(writeAddr(reg));
+        for(auto i = 0; i < len; i++) {
+            sendByte(buf[i]);
+        }
+        RC522_CS_Disable();
+    }
+
+    const char* name() override {
+        return "bitbang";
+    }
+
+private:
+    void delay() {
+#ifdef RT_USING_CPUTIME
+        auto start = clock_cpu_gettime();
+        while(clock_cpu_gettime() - start < halfTicks);
+#endif
+    }
+
+    //模式0: 下降沿后输出数据, 上升沿采样
+    rt_uint8_t transferByte(rt_uint8_t out) {
+        rt_uint8_t in = 0;
+        for(auto i = 0; i < 8; i++) {
+            RC522_SCK_0();
+            if(out & 0x80)
+                RC522_MOSI_1();
+            else
+                RC522_MOSI_0();
+            out <<= 1;
+            delay();
+            RC522_SCK_1();
+            in <<= 1;
+            if(RC522_MISO_GET() == PIN_HIGH)
+                in |= 0x01;
+            delay();
+        }
+        RC522_SCK_0();
+        return in;
+    }
+
+    void sendByte(rt_uint8_t byte) {
+        transferByte(byte);
+    }
+
+    rt_uint8_t recvByte() {
+        return transferByte(0);
+    }
+
+    rt_uint32_t halfTicks = 0;
+};
+
+static Rc522BitBangTransport bitbang_transport;
+
+Rc522Transport* rc522_transport_probe() {
+#ifdef BSP_USING_SPI1
+    if(spi_transport.init() == RT_EOK) {
+        LOG_I("using hardware spi");
+        return &spi_transport;
+    }
+    LOG_W("hardware spi unavailable, fallback to bitbang");
+#endif
+    bitbang_transport.init();
+    return &bitbang_transport;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-06     imgcr       the first version
+ */
+#ifndef APPLICATIONS_RC522_TRANSPORT_H_
+#define APPLICATIONS_RC522_TRANSPORT_H_
+
+#include <rtthread.h>
+
+#ifndef RC522_SPI_BUS
+#define RC522_SPI_BUS "spi1"
+#endif
+#ifndef RC522_SPI_DEVICE
+#define RC522_SPI_DEVICE "spi10"
+#endif
+#ifndef RC522_SPI_CS_GPIO_PIN
+#define RC522_SPI_CS_GPIO_PIN GPIO_PIN_4 //与RC522_SPI_GPIO组成硬件SPI的片选, 对应RC522_CS_PIN
+#endif
+#define RC522_SPI_MAX_HZ (5 * 1000 * 1000) //MFRC522最高10MHz
+#define RC522_BITBANG_HALF_NS 100 //软件SPI半个时钟周期的最短时间
+
+//MFRC522寄存器访问接口, 地址为寄存器号, 由实现负责编码读写位
+struct Rc522Transport {
+    virtual rt_err_t init() = 0;
+    virtual rt_uint8_t read(rt_uint8_t reg) = 0;
+    virtual void write(rt_uint8_t reg, rt_uint8_t val) = 0;
+
+    //同一寄存器(FIFODataReg)的连续读写, 一次片选完成
+    virtual void readBurst(rt_uint8_t reg, rt_uint8_t* buf, rt_uint8_t len) = 0;
+    virtual void writeBurst(rt_uint8_t reg, const rt_uint8_t* buf, rt_uint8_t len) = 0;
+
+    virtual const char* name() = 0;
+
+protected:
+    static rt_uint8_t readAddr(rt_uint8_t reg) {
+        return ((reg << 1) & 0x7e) | 0x80;
+    }
+
+    static rt_uint8_t writeAddr(rt_uint8_t reg) {
+        return (reg << 1) & 0x7e;
+    }
+};
+
+//优先使用硬件SPI1, 不可用时退回软件SPI
+Rc522Transport* rc522_transport_probe();
+
+#endif /* APPLICATIONS_RC522_TRANSPORT_H_ */
@@ -11,29 +11,18 @@
 #include <rtthread.h>
 #include <relay.h>
 #include <rtdevice.h>
-
-#define PIN_RELAY_1 18
-#define PIN_RELAY_2 23
-
+#include "ports.h"
 
 int relay_init() {
-    rt_pin_mode(PIN_RELAY_1, PIN_MODE_OUTPUT);
-    rt_pin_mode(PIN_RELAY_2, PIN_MODE_OUTPUT);
-
-    rt_pin_write(PIN_RELAY_1, PIN_LOW);
-    rt_pin_write(PIN_RELAY_2, PIN_LOW);
+    for(auto& desc: port_descs) {
+        rt_pin_mode(desc.relayPin, PIN_MODE_OUTPUT);
+        rt_pin_write(desc.relayPin, PIN_LOW);
+    }
+    return RT_EOK;
 }
 
-void relay_ctl(Relay relay, rt_base_t val) {
-    switch(relay) {
-        case Relay::First:
-            rt_pin_write(PIN_RELAY_1, val);
-            break;
-        case Relay::Second:
-            rt_pin_write(PIN_RELAY_2, val);
-            break;
-    }
+void relay_ctl(rt_base_t pin, rt_base_t val) {
+    rt_pin_write(pin, val);
 }
 
 INIT_BOARD_EXPORT(relay_init);
-
@@ -11,11 +11,15 @@
 #define APPLICATIONS_RELAY_H_
 
 
-enum class Relay {
-    First,
-    Second,
-};
+#include <rtthread.h>
 
-void relay_ctl(Relay relay, rt_base_t val);
+#ifndef RELAY1_PIN
+#define RELAY1_PIN 18
+#endif
+#ifndef RELAY2_PIN
+#define RELAY2_PIN 23
+#endif
+
+void relay_ctl(rt_base_t pin, rt_base_t val);
 
 #endif /* APPLICATIONS_RELAY_H_ */
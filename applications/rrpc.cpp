@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-09     imgcr       the first version
+ */
+
+#include <rthw.h>
+#include <rtdevice.h>
+#include <string.h>
+#include "rrpc.h"
+#include "at_json.h"
+
+#define LOG_TAG "rrpc"
+#define LOG_LVL LOG_LVL_DBG
+#include <ulog.h>
+
+#define RRPC_TOPIC "/rrpc/request/"
+#define RRPC_METHOD_PREFIX "thing.service."
+
+namespace {
+
+//只向前扫描的JSON游标, 仅支持RRPC请求用到的子集, 字符串不做反转义
+struct JsonCursor {
+    const char* p;
+    const char* end;
+
+    void ws() {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+    }
+
+    bool eat(char c) {
+        ws();
+        if(p < end && *p == c) {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    bool string(const char*& s, int& len) {
+        if(!eat('"'))
+            return false;
+        s = p;
+        while(p < end && *p != '"') {
+            if(*p == '\\')
+                p++;
+            p++;
+        }
+        if(p >= end)
+            return false;
+        len = p - s;
+        p++;
+        return true;
+    }
+
+    bool integer(int& v) {
+        ws();
+        auto neg = p < end && *p == '-';
+        if(neg)
+            p++;
+        if(p >= end || *p < '0' || *p > '9')
+            return false;
+        v = 0;
+        while(p < end && *p >= '0' && *p <= '9')
+            v = v * 10 + (*p++ - '0');
+        //小数部分直接截断
+        if(p < end && *p == '.') {
+            p++;
+            while(p < end && *p >= '0' && *p <= '9')
+                p++;
+        }
+        if(neg)
+            v = -v;
+        return true;
+    }
+
+    bool skip() {
+        ws();
+        if(p >= end)
+            return false;
+        const char* s;
+        int len;
+        switch(*p) {
+            case '"':
+                return string(s, len);
+            case '{':
+            case '[': {
+                auto depth = 0;
+                while(p < end) {
+                    if(*p == '"') {
+                        if(!string(s, len))
+                            return false;
+                        continue;
+                    }
+                    if(*p == '{' || *p == '[')
+                        depth++;
+                    else if(*p == '}' || *p == ']')
+                        depth--;
+                    p++;
+                    if(depth == 0)
+                        return true;
+                }
+                return false;
+            }
+            default:
+                while(p < end && *p != ',' && *p != '}' && *p != ']')
+                    p++;
+                return true;
+        }
+    }
+
+    //遍历对象的每个键, f返回false表示该值未被消费, 由游标跳过
+    template<class F>
+    bool object(F f) {
+        if(!eat('{'))
+            return false;
+        if(eat('}'))
+            return true;
+        do {
+            const char* k;
+            int klen;
+            if(!string(k, klen) || !eat(':'))
+                return false;
+            auto before = p;
+            if(!f(k, klen)) {
+                p = before;
+                if(!skip())
+                    return false;
+            }
+        } while(eat(','));
+        return eat('}');
+    }
+};
+
+bool key_is(const char* k, int klen, const char* name) {
+    return (int)strlen(name) == klen && memcmp(k, name, klen) == 0;
+}
+
+//去掉公共前缀后按长度即可区分: control(7), stop(4), query(5)
+RrpcMethod method_of(const char* s, int len) {
+    const int prefix = sizeof(RRPC_METHOD_PREFIX) - 1;
+    if(len <= prefix || memcmp(s, RRPC_METHOD_PREFIX, prefix) != 0)
+        return RrpcMethod::Unknown;
+    s += prefix;
+    len -= prefix;
+    switch(len) {
+        case 7:
+            return memcmp(s, "control", 7) == 0 ? RrpcMethod::Control : RrpcMethod::Unknown;
+        case 4:
+            return memcmp(s, "stop", 4) == 0 ? RrpcMethod::Stop : RrpcMethod::Unknown;
+        case 5:
+            return memcmp(s, "query", 5) == 0 ? RrpcMethod::Query : RrpcMethod::Unknown;
+        default:
+            return RrpcMethod::Unknown;
+    }
+}
+
+const char* find(const char* p, const char* end, char c) {
+    while(p < end && *p != c)
+        p++;
+    return p < end ? p : RT_NULL;
+}
+
+}
+
+//+MSUB: "/sys/<pk>/<dn>/rrpc/request/<id>",<n> byte,{...}
+bool rrpc_parse(const char* line, rt_size_t size, RrpcRequest& req) {
+    const char* end = line + size;
+    rt_memset(&req, 0, sizeof(req));
+
+    auto topic = find(line, end, '"');
+    if(topic == RT_NULL)
+        return false;
+    topic++;
+    auto topicEnd = find(topic, end, '"');
+    if(topicEnd == RT_NULL)
+        return false;
+
+    const int tlen = sizeof(RRPC_TOPIC) - 1;
+    const char* id = RT_NULL;
+    for(auto p = topic; p + tlen <= topicEnd; p++) {
+        if(memcmp(p, RRPC_TOPIC, tlen) == 0) {
+            id = p + tlen;
+            break;
+        }
+    }
+    if(id == RT_NULL || id == topicEnd || topicEnd - id >= RRPC_REQ_ID_MAX)
+        return false;
+    rt_memcpy(req.reqId, id, topicEnd - id);
+
+    auto json = find(topicEnd, end, '{');
+    if(json == RT_NULL)
+        return false;
+
+    JsonCursor cur = {json, end};
+    auto ok = cur.object([&](const char* k, int klen) {
+        if(key_is(k, klen, "method")) {
+            const char* s;
+            int len;
+            if(!cur.string(s, len))
+                return false;
+            req.method = method_of(s, len);
+            return true;
+        }
+        if(key_is(k, klen, "params")) {
+            return cur.object([&](const char* k, int klen) {
+                if(key_is(k, klen, "port"))
+                    return cur.integer(req.port);
+                if(key_is(k, klen, "minutes"))
+                    return cur.integer(req.minutes);
+                if(key_is(k, klen, "timer_id"))
+                    return cur.integer(req.timerId);
+                return false;
+            });
+        }
+        return false;
+    });
+
+    return ok && req.method != RrpcMethod::Unknown;
+}
+
+//直方图桶上界(ms), 最后一个桶收集更慢的请求
+static const rt_uint16_t bucket_bounds[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000};
+#define RRPC_BUCKETS (sizeof(bucket_bounds) / sizeof(bucket_bounds[0]) + 1)
+
+static const char* const stage_names[RRPC_STAGE_COUNT] = {
+    "parse", "queue", "callback", "respond", "encode", "exec", "total",
+};
+
+struct StageStats {
+    rt_uint16_t buckets[RRPC_BUCKETS];
+    rt_uint32_t maxUs;
+};
+
+static rt_uint32_t traces[RRPC_TRACE_MAX][RRPC_STAGE_COUNT];
+static rt_uint8_t trace_used = 0;
+static StageStats stage_stats[RRPC_STAGE_COUNT];
+static rt_uint32_t completed = 0, aborted = 0, untraced = 0;
+
+int rrpc_trace_begin(rt_uint32_t urcStamp) {
+    rt_base_t level = rt_hw_interrupt_disable();
+    for(auto i = 0; i < RRPC_TRACE_MAX; i++) {
+        if((trace_used & (1 << i)) == 0) {
+            trace_used |= 1 << i;
+            rt_hw_interrupt_enable(level);
+            rt_memset(traces[i], 0, sizeof(traces[i]));
+            traces[i][(int)RrpcMark::Urc] = urcStamp;
+            return i;
+        }
+    }
+    untraced++;
+    rt_hw_interrupt_enable(level);
+    return -1;
+}
+
+void rrpc_trace_mark(int trace, RrpcMark mark) {
+    if(trace < 0)
+        return;
+    traces[trace][(int)mark] = clock_cpu_gettime();
+}
+
+static void trace_free(int trace) {
+    rt_base_t level = rt_hw_interrupt_disable();
+    trace_used &= ~(1 << trace);
+    rt_hw_interrupt_enable(level);
+}
+
+static void record(int stage, rt_uint32_t from, rt_uint32_t to) {
+    auto us = clock_cpu_microsecond(to - from);
+    auto& st = stage_stats[stage];
+    auto ms = us / 1000;
+    auto b = 0;
+    while(b < (int)RRPC_BUCKETS - 1 && ms >= bucket_bounds[b])
+        b++;
+    if(st.buckets[b] != 0xffff)
+        st.buckets[b]++;
+    if(us > st.maxUs)
+        st.maxUs = us;
+}
+
+void rrpc_trace_end(int trace) {
+    if(trace < 0)
+        return;
+    auto& t = traces[trace];
+    //各阶段耗时 = 相邻两个打点之差, 最后一项为总耗时
+    for(auto i = 0; i < RRPC_STAGE_COUNT - 1; i++) {
+        record(i, t[i], t[i + 1]);
+    }
+    record(RRPC_STAGE_COUNT - 1, t[(int)RrpcMark::Urc], t[(int)RrpcMark::Sent]);
+    completed++;
+    trace_free(trace);
+}
+
+void rrpc_trace_abort(int trace) {
+    if(trace < 0)
+        return;
+    aborted++;
+    trace_free(trace);
+}
+
+//按直方图估算分位数, 返回所在桶的上界(ms)
+static int percentile_ms(const StageStats& st, int pct) {
+    rt_uint32_t total = 0;
+    for(auto c: st.buckets)
+        total += c;
+    if(total == 0)
+        return 0;
+    rt_uint32_t acc = 0;
+    for(auto b = 0; b < (int)RRPC_BUCKETS; b++) {
+        acc += st.buckets[b];
+        if(acc * 100 >= total * pct)
+            return b < (int)RRPC_BUCKETS - 1 ? bucket_bounds[b] : -1;
+    }
+    return -1;
+}
+
+void rrpc_stats_write(AtJson& w) {
+    auto& st = stage_stats[RRPC_STAGE_COUNT - 1];
+    w.key("rrpc_latency").beginObject();
+    w.key("count").num((int)completed);
+    w.key("p50").num(percentile_ms(st, 50));
+    w.key("p90").num(percentile_ms(st, 90));
+    w.key("max").num((int)(st.maxUs / 1000));
+    w.endObject();
+}
+
+void rrpc_stats(int argc, char** argv) {
+    if(argc > 1 && strcmp(argv[1], "reset") == 0) {
+        rt_memset(stage_stats, 0, sizeof(stage_stats));
+        completed = aborted = untraced = 0;
+        return;
+    }
+    rt_kprintf("completed %d, aborted %d, untraced %d\n", completed, aborted, untraced);
+    for(auto i = 0; i < RRPC_STAGE_COUNT; i++) {
+        auto& st = stage_stats[i];
+        char line[96];
+        auto n = 0;
+        for(auto b = 0; b < (int)RRPC_BUCKETS && n < (int)sizeof(line); b++) {
+            n += rt_snprintf(line + n, sizeof(line) - n, "%d ", st.buckets[b]);
+        }
+        rt_kprintf("%-8s p50<=%dms p90<=%dms max %dus | %s\n", stage_names[i], percentile_ms(st, 50), percentile_ms(st, 90), st.maxUs, line);
+    }
+}
+
+MSH_CMD_EXPORT(rrpc_stats, show rrpc latency histograms: rrpc_stats [reset])
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-09     imgcr       the first version
+ */
+#ifndef APPLICATIONS_RRPC_H_
+#define APPLICATIONS_RRPC_H_
+
+#include <rtthread.h>
+
+#define RRPC_REQ_ID_MAX 24
+
+enum class RrpcMethod: rt_uint8_t {
+    Unknown,
+    Control, //<- thing.service.control
+    Stop, //<- thing.service.stop
+    Query, //<- thing.service.query
+};
+
+//+MSUB中解析出的RRPC请求, 定长, 可直接放入消息队列
+struct RrpcRequest {
+    RrpcMethod method;
+    int port, minutes, timerId;
+    char reqId[RRPC_REQ_ID_MAX];
+    int trace;
+};
+
+//在URC接收行上原地解析, 不分配内存; 非RRPC主题、未知方法或格式错误时返回false
+bool rrpc_parse(const char* line, rt_size_t size, RrpcRequest& req);
+
+//RRPC各阶段打点, 时间取自DWT周期计数器(cputime)
+enum class RrpcMark: rt_uint8_t {
+    Urc, //<- 收到+MSUB
+    Parsed, //<- 解析完成并入队
+    Dequeued, //<- poll()取出
+    Handled, //<- 控制回调(继电器+EEPROM)返回, 应答入队
+    Sending, //<- 发送线程取出应答
+    Encoded, //<- MPUB指令渲染完成
+    Sent, //<- AT+MPUB返回
+    Count,
+};
+
+#define RRPC_TRACE_MAX 4 //同时跟踪的请求数
+//#define RRPC_STATS_PROPERTY //随周期属性一起上报rrpc_latency
+#define RRPC_STAGE_COUNT ((int)RrpcMark::Count)
+
+//没有空闲跟踪槽时返回-1, 该请求不计入统计; 之后对-1的调用均为空操作
+int rrpc_trace_begin(rt_uint32_t urcStamp);
+void rrpc_trace_mark(int trace, RrpcMark mark);
+//请求完整走完时把各阶段耗时计入直方图, 中途丢弃的请求调用abort
+void rrpc_trace_end(int trace);
+void rrpc_trace_abort(int trace);
+
+struct AtJson;
+//总耗时的计数、分位数和最大值, 作为属性上报
+void rrpc_stats_write(AtJson& w);
+
+#endif /* APPLICATIONS_RRPC_H_ */
@@ -19,24 +19,47 @@
 #include <string.h>
 
 #include <state.h>
+#include "executor.h"
+#include "ports.h"
+#include "wheel.h"
 
 using namespace std;
 
+#ifndef STATE_SERIAL
 #define STATE_SERIAL "uart3"
+#endif
 
 static rt_device_t serial;
 static rt_event_t event;
+static rt_mutex_t lock; //<- 串口由采样线程与配置过程共享
 static volatile int rx_remain = 0;
 
 enum state_event {
     state_event_serial_indicate = 1,
+    state_event_hlw_irq = 2,
 };
 
-rt_timer_t lod_detect_timer;
-LodDetect lodDetectA(PORTA_DETECT_PIN), lodDetectB(PORTB_DETECT_PIN);
+static Job lodDispatchJob(Lane::Control, [] {
+    for(auto& p: ports) {
+        p.detect.dispatch();
+    }
+});
+
+//50Hz的波形, 20ms的高电平
+static WheelTimer lodDetectTimer([](auto p) {
+    lodDetectJitter.hit();
+    bool pending = false;
+    for(auto& port: ports) {
+        pending = port.detect.update() || pending;
+    }
+    if(pending) {
+        lodDispatchJob.submit();
+    }
+}, RT_NULL, 10, true);
 
 static int init_state() {
     event = rt_event_create(LOG_TAG, RT_IPC_FLAG_FIFO);
+    lock = rt_mutex_create(LOG_TAG, RT_IPC_FLAG_FIFO);
     serial = rt_device_find(STATE_SERIAL);
     struct serial_configure conf = RT_SERIAL_CONFIG_DEFAULT;
     conf.data_bits = DATA_BITS_9;
@@ -50,17 +73,11 @@ static int init_state() {
         return RT_EOK;
     });
 
-    lodDetectA.init();
-    lodDetectB.init();
-
-    //创建定时器
-    lod_detect_timer = rt_timer_create(LOG_TAG, [](auto p) {
-        //50Hz的波形  //20ms的高电平
-        lodDetectA.update();
-        lodDetectB.update();
-    }, RT_NULL, 10, RT_TIMER_FLAG_PERIODIC | RT_TIMER_FLAG_SOFT_TIMER);
+    for(auto& p: ports) {
+        p.detect.init();
+    }
 
-    rt_timer_start(lod_detect_timer);
+    lodDetectTimer.start();
 
     return RT_EOK;
 }
@@ -78,6 +95,20 @@ static rt_err_t serial_recv_wait(void* data, int len) {
     return RT_EOK;
 }
 
+//丢弃上次超时残留的应答, 避免批量读取错位
+static void serial_flush() {
+    char buf[16];
+    rt_base_t level = rt_hw_interrupt_disable();
+    int remain = rx_remain;
+    rx_remain = 0;
+    rt_hw_interrupt_enable(level);
+    while(remain > 0) {
+        int len = remain > (int)sizeof(buf) ? sizeof(buf) : remain;
+        rt_device_read(serial, 0, buf, len);
+        remain -= len;
+    }
+}
+
 void hlw_cmd(int cmd, void* data, int len) {
     char b = 0xa5, cs = 0;
    rt_device_write(serial, 0, &b, 1);
@@ -110,31 +141,56 @@ void hlw_reg_write(int addr, void* data, int len) {
     hlw_cmd(addr | 0x80, data, len);
 }
 
-rt_err_t hlw_reg_read(int addr, void* data, int len) {
-    char b = 0xa5, cs_expect = 0, cs;
-    rt_device_write(serial, 0, &b, 1);
-    cs_expect += b;
+rt_err_t hlw_reg_read_many(hlw_read_req* reqs, int n) {
+    char tx[HLW_BATCH_MAX * 2], rx[HLW_BATCH_MAX * 5];
+    int rx_len = 0;
 
-    b = addr;
-    rt_device_write(serial, 0, &b, 1);
-    cs_expect += b;
+    if(n <= 0 || n > HLW_BATCH_MAX)
+        return -RT_EINVAL;
 
-    for(char* p = (char*)data + len - 1; p >= (char*)data; p--) {
-        if(serial_recv_wait(p, 1) != RT_EOK) {
-            return RT_ETIMEOUT;
-        }
-        cs_expect += *p;
+    for(auto i = 0; i < n; i++) {
+        tx[i * 2] = 0xa5;
+        tx[i * 2 + 1] = reqs[i].addr;
+        rx_len += reqs[i].len + 1; //数据 + 校验和
     }
-    cs_expect = ~cs_expect;
-    if(serial_recv_wait(&cs, 1) != RT_EOK) {
+    rt_mutex_take(lock, RT_WAITING_FOREVER);
+    serial_flush();
+    rt_device_write(serial, 0, tx, n * 2);
+    rt_err_t recv_err = serial_recv_wait(rx, rx_len);
+    rt_mutex_release(lock);
+
+    if(recv_err != RT_EOK) {
+        for(auto i = 0; i < n; i++) {
+            reqs[i].err = RT_ETIMEOUT;
+        }
         return RT_ETIMEOUT;
     }
-    if(cs != cs_expect) {
-        LOG_E("exp: %x", cs_expect);
-        return -RT_ERROR;
+
+    rt_err_t err = RT_EOK;
+    char* p = rx;
+    for(auto i = 0; i < n; i++) {
+        char cs_expect = 0xa5 + reqs[i].addr;
+        //高字节在前
+        for(char* d = (char*)reqs[i].data + reqs[i].len - 1; d >= (char*)reqs[i].data; d--) {
+            *d = *p++;
+            cs_expect += *d;
+        }
+        cs_expect = ~cs_expect;
+        if(*p++ != cs_expect) {
+            LOG_E("[%02x] exp: %x", reqs[i].addr, cs_expect);
+            reqs[i].err = -RT_ERROR;
+            err = -RT_ERROR;
+        } else {
+            reqs[i].err = RT_EOK;
+        }
     }
 
-    return RT_EOK;
+    return err;
+}
+
+rt_err_t hlw_reg_read(int addr, void* data, int len) {
+    hlw_read_req req = {addr, data, len, RT_EOK};
+    return hlw_reg_read_many(&req, 1);
 }
 
 template <class T>
@@ -209,19 +265,145 @@ void state_hw_config() {
 }
 
 void Hlw::config() {
+    rt_mutex_take(lock, RT_WAITING_FOREVER);
+    invalidateCoeff();
     state_hw_config();
+    if(loadCoeff() != RT_EOK) {
+        LOG_W("coeff load failed, retry on next sample");
+    }
+    rt_mutex_release(lock);
+    startSampling();
+}
+
+void Hlw::startSampling() {
+    if(samplingThread != RT_NULL)
+        return;
+
+    rt_pin_mode(HLW_IRQ_PIN, PIN_MODE_INPUT_PULLUP);
+    rt_pin_attach_irq(HLW_IRQ_PIN, PIN_IRQ_MODE_FALLING, [](auto p) {
+        rt_event_send(event, state_event_hlw_irq);
+    }, RT_NULL);
+    rt_pin_irq_enable(HLW_IRQ_PIN, PIN_IRQ_ENABLE);
+
+    samplingThread = rt_thread_create("hlw", samplingEntry, this, 1024, 9, 10);
+    rt_thread_startup(samplingThread);
 }
 
-float Hlw::getU(rt_err_t* err) {
-    auto val = hlw_reg_read<rms_u>(err);
-    if(*err != RT_EOK) return 0;
-    auto rmsUC = hlw_reg_read<rms_u_c>(err);
-    if(*err != RT_EOK) return 0;
-    float rmsU = 1.0 * val.data * rmsUC / (1.0 * (1 << 22)) / 100; //单位10mV
-    if(err) *err = RT_EOK;
-    return rmsU;
+void Hlw::samplingEntry(void* p) {
+    auto self = (Hlw*)p;
+    while(true) {
+        //超时也采样一次, 避免IRQ线异常时数据停止更新
+        rt_event_recv(event, state_event_hlw_irq, RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, self->nextWait(), RT_NULL);
+        self->sampleWithRetry();
+    }
+}
+
+rt_err_t Hlw::sampleWithRetry() {
+    rt_err_t err = RT_EOK;
+    //降级模式下每次唤醒只试探一次, 恢复由下一次成功采样发现
+    auto tries = consecutive >= HLW_DEGRADE_THRESHOLD ? 1 : HLW_RETRY_MAX;
+    for(auto i = 0; i < tries; i++) {
+        if(i > 0) {
+            rt_thread_mdelay(HLW_RETRY_DELAY);
+        }
+        auto m = measure(&err);
+        if(err == RT_EOK) {
+            snapshot.publish({m, rt_tick_get()});
+            if(consecutive >= HLW_DEGRADE_THRESHOLD) {
+                LOG_I("metering recovered after %d failures", consecutive);
+            }
+            consecutive = 0;
+            return RT_EOK;
+        }
+    }
+
+    faults++;
+    consecutive++;
+    if(consecutive == HLW_DEGRADE_THRESHOLD) {
+        LOG_E("metering degraded: %d", err);
+    } else if(consecutive < HLW_DEGRADE_THRESHOLD) {
+        LOG_W("sample failed: %d", err);
+    }
+    return err;
+}
+
+//正常时按兜底周期采样, 连续失败后指数退避, 不再频繁占用串口
+rt_int32_t Hlw::nextWait() {
+    if(consecutive < HLW_DEGRADE_THRESHOLD)
+        return HLW_SAMPLE_TIMEOUT;
+    auto shift = consecutive - HLW_DEGRADE_THRESHOLD + 1;
+    if(shift > 5) shift = 5;
+    rt_int32_t wait = HLW_SAMPLE_TIMEOUT << shift;
+    return wait > HLW_BACKOFF_MAX ? HLW_BACKOFF_MAX : wait;
+}
+
+rt_err_t Hlw::loadCoeff() {
+    rt_err_t err;
+    auto regs = hlw_reg_read_many<rms_i_a_c, rms_i_b_c, rms_u_c, power_pa_c, power_pb_c, power_s_c, energy_a_c, energy_b_c, coeff_chksum>(RT_NULL, &err);
+    if(err != RT_EOK) {
+        invalidateCoeff();
+        return err;
+    }
+
+    //chksum = ~(0xffff + 所有系数寄存器之和)
+    rt_uint16_t sum = 0xffff + get<0>(regs) + get<1>(regs) + get<2>(regs) + get<3>(regs)
+            + get<4>(regs) + get<5>(regs) + get<6>(regs) + get<7>(regs);
+    sum = ~sum;
+    if(sum != get<8>(regs)) {
+        LOG_E("coeff chksum mismatch: %04x != %04x", sum, get<8>(regs));
+        invalidateCoeff();
+        return -RT_ERROR;
+    }
+
+    coeff.rmsIC[Port::A] = get<0>(regs);
+    coeff.rmsIC[Port::B] = get<1>(regs);
+    coeff.rmsUC = get<2>(regs);
+    coeff.valid = true;
+    return RT_EOK;
+}
+
+auto Hlw::measure(rt_err_t* err) -> Measurement {
+    rt_err_t local_err = ensureCoeff();
+    if(local_err == RT_EOK) {
+        //顺带读IF寄存器, 读清零后IRQ_N恢复高电平
+        auto regs = hlw_reg_read_many<ifr, rms_i_a, rms_i_b, rms_u>(RT_NULL, &local_err);
+        if(local_err == RT_EOK) {
+            if(err) *err = RT_EOK;
+            return {
+                iA: cvtI(get<1>(regs).data, coeff.rmsIC[Port::A]),
+                iB: cvtI(get<2>(regs).data, coeff.rmsIC[Port::B]),
+                u: cvtU(get<3>(regs).data, coeff.rmsUC),
+            };
+        }
+        invalidateCoeff(); //通信异常可能是芯片复位, 下次重新加载系数
+    }
+    if(err) *err = local_err;
+    return { };
 }
 
 Hlw hlw;
 
+void hlw_coeff() {
+    auto& c = hlw.getCoeff();
+    rt_kprintf("valid: %d\n", c.valid);
+    rt_kprintf("rms_i_a_c: 0x%04x\n", c.rmsIC[Hlw::Port::A]);
+    rt_kprintf("rms_i_b_c: 0x%04x\n", c.rmsIC[Hlw::Port::B]);
+    rt_kprintf("rms_u_c: 0x%04x\n", c.rmsUC);
+}
+
+void hlw_health() {
+    auto h = hlw.getHealth();
+    Hlw::Snapshot snap;
+    rt_kprintf("faults: %d\n", h.faults);
+    rt_kprintf("consecutive: %d\n", h.consecutive);
+    rt_kprintf("degraded: %d\n", h.degraded);
+    if(hlw.latest(snap)) {
+        rt_kprintf("age: %dms\n", Hlw::getAge(snap) * 1000 / RT_TICK_PER_SECOND);
+    } else {
+        rt_kprintf("age: -\n");
+    }
+}
+
 INIT_APP_EXPORT(init_state);
+MSH_CMD_EXPORT(hlw_coeff, dump cached hlw8112 coefficients)
+MSH_CMD_EXPORT(hlw_health, show hlw8112 metering health)
@@ -16,10 +16,24 @@
 #include <type_traits>
 #include <functional>
 #include <tuple>
+#include <utility>
+#include <atomic>
 
 #define DETECT_QUEUE_SIZE 10
+#ifndef PORTA_DETECT_PIN
 #define PORTA_DETECT_PIN 16
+#endif
+#ifndef PORTB_DETECT_PIN
 #define PORTB_DETECT_PIN 17
+#endif
+#ifndef HLW_IRQ_PIN
+#define HLW_IRQ_PIN 28 //HLW8112 P1脚(IRQ_N), 均值更新时拉低
+#endif
+#define HLW_SAMPLE_TIMEOUT 1000 //IRQ丢失时的兜底采样周期(ms)
+#define HLW_RETRY_MAX 3 //单次采样的最大重试次数
+#define HLW_RETRY_DELAY 100 //两次重试之间的间隔, 让串口上的残留应答先过去(ms)
+#define HLW_DEGRADE_THRESHOLD 3 //连续失败多少次后进入降级模式
+#define HLW_BACKOFF_MAX 30000 //降级模式下的最长退避时间(ms)
 
 void state_hw_config();
 
@@ -38,14 +52,23 @@ struct LodDetect {
         rt_pin_irq_enable(pin, PIN_IRQ_ENABLE);
     }
 
-    //以10Hz频率调用
-    void update() {
+    //以10Hz频率调用, 只记录状态变化, 有待通知的变化时返回true
+    bool update() {
         bool curState = (rt_tick_get() - tick) < 100;
         if(curState != state) {
             state = curState;
-            if(onStateChangedCb) {
-                onStateChangedCb(state);
-            }
+            pending = true;
+        }
+        return pending;
+    }
+
+    //在工作队列中调用, 通知最新状态
+    void dispatch() {
+        if(!pending)
+            return;
+        pending = false;
+        if(onStateChangedCb) {
+            onStateChangedCb(state);
         }
     }
 
@@ -62,10 +85,9 @@ private:
     rt_base_t pin;
     rt_int64_t tick;
     bool state;
+    volatile bool pending = false;
 };
 
-extern LodDetect lodDetectA, lodDetectB;
-
 template <class T, int Addr, int Size=0, bool Write=true>
 struct reg_def {
     static const int addr = Addr;
@@ -208,6 +230,12 @@ using peak_u = reg_def<reg_peak_u, 0x32, 3>;
 using rms_i_a_c = reg_def<uint16_t, 0x70>;
 using rms_i_b_c = reg_def<uint16_t, 0x71>;
 using rms_u_c = reg_def<uint16_t, 0x72>;
+using power_pa_c = reg_def<uint16_t, 0x73>;
+using power_pb_c = reg_def<uint16_t, 0x74>;
+using power_s_c = reg_def<uint16_t, 0x75>;
+using energy_a_c = reg_def<uint16_t, 0x76>;
+using energy_b_c = reg_def<uint16_t, 0x77>;
+using coeff_chksum = reg_def<uint16_t, 0x6f, 0, false>; //系数校验和
 
 struct reg_ie {
     rt_int16_t dupd: 1; //<- 均值数据更新
@@ -278,24 +306,146 @@ auto hlw_reg_read(rt_err_t* err = RT_NULL) {
     return reg;
 }
 
+#define HLW_BATCH_MAX 10
+
+struct hlw_read_req {
+    int addr;
+    void* data;
+    int len;
+    rt_err_t err; //<- 单个寄存器的接收/校验结果
+};
+
+rt_err_t hlw_reg_read_many(hlw_read_req* reqs, int n);
+
+template <class Tuple, std::size_t... I>
+void hlw_bind_reqs(hlw_read_req* reqs, Tuple& regs, std::index_sequence<I...>) {
+    int unused[] = {(reqs[I].data = &std::get<I>(regs), 0)...};
+    (void)unused;
+}
+
+//所有读命令合并为一次发送, 应答一次性从DMA缓冲区取出
+//errs(可选)需能容纳sizeof...(Ts)个元素, 保存每个寄存器的校验结果
+template <class... Ts>
+auto hlw_reg_read_many(rt_err_t* errs = RT_NULL, rt_err_t* err = RT_NULL) {
+    static_assert(sizeof...(Ts) <= HLW_BATCH_MAX, "too many registers in one batch");
+    std::tuple<typename Ts::reg...> regs{};
+    hlw_read_req reqs[] = {{Ts::addr, RT_NULL, Ts::size, RT_EOK}...};
+    hlw_bind_reqs(reqs, regs, std::index_sequence_for<Ts...>{});
+    rt_err_t local_err = hlw_reg_read_many(reqs, sizeof...(Ts));
+    if(errs) {
+        for(auto i = 0u; i < sizeof...(Ts); i++) {
+            errs[i] = reqs[i].err;
+        }
+    }
+    if(err) {
+        *err = local_err;
+    }
+    return regs;
+}
+
+//单写多读的双缓冲, 读者不加锁也不阻塞写者; 读取期间发生写入则重读
+template <class T>
+struct DoubleBuffer {
+    void publish(const T& val) {
+        auto s = seq.load(std::memory_order_relaxed);
+        buf[(s + 1) & 1] = val;
+        seq.store(s + 1, std::memory_order_release);
+    }
+
+    //尚未发布过数据时返回false
+    bool read(T& out) const {
+        rt_uint32_t s;
+        do {
+            s = seq.load(std::memory_order_acquire);
+            out = buf[s & 1];
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while(s != seq.load(std::memory_order_relaxed));
+        return s != 0;
+    }
+
+private:
+    T buf[2] = { };
+    std::atomic<rt_uint32_t> seq{0};
+};
+
 struct Hlw {
 
     enum Port {
         A = 0, B,
     };
 
+    struct Measurement {
+        float iA, iB, u;
+
+        float i(Port p) const {
+            return p == A ? iA : iB;
+        }
+    };
+
+    //校准系数在芯片内为常量, 复位或校验失败后才需要重新读取
+    struct Coeff {
+        rt_uint16_t rmsIC[2];
+        rt_uint16_t rmsUC;
+        bool valid;
+    };
+
     void config();
 
-    template <Port P>
-    float getI(rt_err_t* err = RT_NULL) {
-        using rms_mt = std::tuple_element_t<P, std::tuple<std::pair<rms_i_a, rms_i_a_c>, std::pair<rms_i_b, rms_i_b_c>>>;
-        auto val = hlw_reg_read<typename rms_mt::first_type>();
-        auto rmsIC = hlw_reg_read<typename rms_mt::second_type>();
-        float rmsI = 1.0 * val.data * rmsIC / (1 << 23) / 1.7;
-        if(err) *err = RT_EOK;
-        return rmsI;
+    struct Snapshot {
+        Measurement m;
+        rt_tick_t tick; //<- 采样时刻
+    };
+
+    //一次批量读取两路电流与电压
+    Measurement measure(rt_err_t* err = RT_NULL);
+
+    //降级模式下快照保持最后一次成功的值, 由getAge()判断新鲜度
+    struct Health {
+        rt_uint32_t faults; //<- 累计失败次数
+        rt_uint32_t consecutive; //<- 连续失败次数
+        bool degraded;
+    };
+
+    //由采样线程在每次均值更新中断后刷新, 读取不涉及串口
+    bool latest(Snapshot& snap) {
+        return snapshot.read(snap);
     }
-    float getU(rt_err_t* err = RT_NULL);
+
+    static rt_tick_t getAge(const Snapshot& snap) {
+        return rt_tick_get() - snap.tick;
+    }
+
+    Health getHealth() {
+        return {faults, consecutive, consecutive >= HLW_DEGRADE_THRESHOLD};
+    }
+
+    void startSampling();
+
+    rt_err_t loadCoeff();
+    void invalidateCoeff() { coeff.valid = false; }
+    const Coeff& getCoeff() { return coeff; }
+
+private:
+    rt_err_t ensureCoeff() {
+        return coeff.valid ? RT_EOK : loadCoeff();
+    }
+
+    static float cvtI(rt_uint32_t rms, rt_uint16_t rmsIC) {
+        return 1.0 * rms * rmsIC / (1 << 23) / 1.7;
+    }
+
+    static float cvtU(rt_uint32_t rms, rt_uint16_t rmsUC) {
+        return 1.0 * rms * rmsUC / (1.0 * (1 << 22)) / 100; //单位10mV
+    }
+
+    static void samplingEntry(void* p);
+    rt_err_t sampleWithRetry();
+    rt_int32_t nextWait();
+
+    Coeff coeff = { };
+    DoubleBuffer<Snapshot> snapshot;
+    rt_thread_t samplingThread = RT_NULL;
+    volatile rt_uint32_t faults = 0, consecutive = 0;
 };
 
 extern Hlw hlw;
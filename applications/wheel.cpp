@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-19     imgcr       the first version
+ */
+
+#include <rtthread.h>
+#include <rthw.h>
+#include "wheel.h"
+
+#define LOG_TAG "wheel"
+#define LOG_LVL LOG_LVL_DBG
+#include <ulog.h>
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+struct Wheel {
+    //调用者已关中断
+    static void place(WheelTimer* t) {
+        auto delta = t->expires - now;
+        rt_list_t* slot;
+        if(delta < WHEEL_SLOTS) {
+            slot = &slots[0][t->expires & WHEEL_MASK];
+        } else if(delta < WHEEL_SLOTS * WHEEL_SLOTS) {
+            slot = &slots[1][(t->expires >> WHEEL_BITS) & WHEEL_MASK];
+        } else {
+            slot = &slots[1][((now >> WHEEL_BITS) - 1) & WHEEL_MASK];
+        }
+        rt_list_insert_before(slot, &t->node);
+    }
+
+    //第二级的一格到期时整体下放, 每个定时器最多经过一次
+    static void cascade() {
+        auto slot = &slots[1][(now >> WHEEL_BITS) & WHEEL_MASK];
+        rt_list_t pending;
+        rt_list_init(&pending);
+        if(!rt_list_isempty(slot)) {
+            pending.next = slot->next;
+            pending.prev = slot->prev;
+            pending.next->prev = &pending;
+            pending.prev->next = &pending;
+            rt_list_init(slot);
+        }
+        while(!rt_list_isempty(&pending)) {
+            auto t = rt_list_entry(pending.next, WheelTimer, node);
+            rt_list_remove(&t->node);
+            place(t);
+        }
+    }
+
+    static void tick(void* p) {
+        rt_base_t level = rt_hw_interrupt_disable();
+        now++;
+        if((now & WHEEL_MASK) == 0)
+            cascade();
+
+        auto slot = &slots[0][now & WHEEL_MASK];
+        rt_uint32_t fired = 0;
+        while(!rt_list_isempty(slot)) {
+            auto t = rt_list_entry(slot->next, WheelTimer, node);
+            rt_list_remove(&t->node);
+            if(t->periodic) {
+                t->expires += t->period;
+                place(t);
+            } else {
+                t->active = false;
+            }
+            auto fn = t->fn;
+            auto arg = t->p;
+            rt_hw_interrupt_enable(level);
+            fn(arg);
+            fired++;
+            level = rt_hw_interrupt_disable();
+        }
+        if(fired > maxFired)
+            maxFired = fired;
+        rt_hw_interrupt_enable(level);
+    }
+
+    static rt_list_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    static rt_uint32_t now;
+    static rt_uint32_t maxFired; //<- 单个刻度内触发的最多回调数
+    static rt_timer_t timer;
+};
+
+rt_list_t Wheel::slots[WHEEL_LEVELS][WHEEL_SLOTS];
+rt_uint32_t Wheel::now = 0;
+rt_uint32_t Wheel::maxFired = 0;
+rt_timer_t Wheel::timer;
+
+WheelTimer::WheelTimer(Callback fn, void* p, rt_uint32_t ms, bool periodic): fn(fn), p(p), periodic(periodic) {
+    period = (ms + WHEEL_TICK - 1) / WHEEL_TICK;
+    if(period == 0)
+        period = 1;
+    rt_list_init(&node);
+}
+
+void WheelTimer::start() {
+    rt_base_t level = rt_hw_interrupt_disable();
+    if(active)
+        rt_list_remove(&node);
+    expires = Wheel::now + period;
+    active = true;
+    Wheel::place(this);
+    rt_hw_interrupt_enable(level);
+}
+
+void WheelTimer::stop() {
+    rt_base_t level = rt_hw_interrupt_disable();
+    if(active) {
+        rt_list_remove(&node);
+        active = false;
+    }
+    rt_hw_interrupt_enable(level);
+}
+
+static int init_wheel() {
+    for(auto& level: Wheel::slots) {
+        for(auto& slot: level) {
+            rt_list_init(&slot);
+        }
+    }
+    Wheel::timer = rt_timer_create(LOG_TAG, Wheel::tick, RT_NULL, rt_tick_from_millisecond(WHEEL_TICK), RT_TIMER_FLAG_PERIODIC | RT_TIMER_FLAG_SOFT_TIMER);
+    rt_timer_start(Wheel::timer);
+    return RT_EOK;
+}
+
+void wheel_stats() {
+    rt_kprintf("now: %d ticks, max fired per tick: %d\n", Wheel::now, Wheel::maxFired);
+}
+
+INIT_PREV_EXPORT(init_wheel);
+MSH_CMD_EXPORT(wheel_stats, show timing wheel stats)
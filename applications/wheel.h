@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2006-2020, RT-Thread Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Change Logs:
+ * Date           Author       Notes
+ * 2020-11-19     imgcr       the first version
+ */
+#ifndef APPLICATIONS_WHEEL_H_
+#define APPLICATIONS_WHEEL_H_
+
+#include <rtthread.h>
+
+#define WHEEL_TICK 10 //时间轮的刻度(ms), 整个应用只有这一个周期软件定时器
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 2 //第一级64格x10ms, 第二级64格x640ms, 更远的到期时间在第二级末格等待重新放置
+
+//挂在时间轮上的定时器: 启动, 停止和到期都是O(1), 每个刻度只处理当前格, 与定时器数量无关
+//回调在定时器线程中执行, 与软件定时器一样只能提交Job或做不阻塞的操作
+struct WheelTimer {
+    using Callback = void(*)(void* p);
+
+    WheelTimer(Callback fn, void* p, rt_uint32_t ms, bool periodic);
+
+    //已启动时从现在起重新计时
+    void start();
+    void stop();
+
+    bool isActive() const {
+        return active;
+    }
+
+private:
+    friend struct Wheel;
+
+    rt_list_t node;
+    Callback fn;
+    void* p;
+    rt_uint32_t period; //<- 刻度数
+    rt_uint32_t expires;
+    bool periodic;
+    volatile bool active = false;
+};
+
+#endif /* APPLICATIONS_WHEEL_H_ */
@@ -19,31 +19,127 @@
 #define LOG_LVL LOG_LVL_DBG
 #include <ulog.h>
 
+//外设名与引脚均可在rtconfig.h中覆盖, 以便移植到其他板卡或仿真BSP
+#ifndef WTN_PIN_DATA
 #define WTN_PIN_DATA 31
+#endif
+#ifndef WTN_PIN_BUSY
 #define WTN_PIN_BUSY 30
+#endif
+#ifndef WTN6_TIMER
+#define WTN6_TIMER "timer2"
+#endif
 
 using namespace std;
 
+//新语音入队时取消尚未播放的对应语音; mutual为真时两者互相抵消, 新语音本身也不入队
+static const struct {
+    VoiceFrg voice, cancels;
+    bool mutual;
+} supersede_rules[] = {
+    {VoiceFrg::PortAUnpluged, VoiceFrg::PortAPluged, true},
+    {VoiceFrg::PortAPluged, VoiceFrg::PortAUnpluged, true},
+    {VoiceFrg::PortBUnpluged, VoiceFrg::PortBPluged, true},
+    {VoiceFrg::PortBPluged, VoiceFrg::PortBUnpluged, true},
+    {VoiceFrg::ChargeCompleted, VoiceFrg::StartCharing, false},
+};
+
+static Wtn6::Priority voice_priority(VoiceFrg voice) {
+    switch(voice) {
+        case VoiceFrg::Slience:
+            return Wtn6::Priority::Low;
+        case VoiceFrg::CardDetected:
+        case VoiceFrg::StartCharing:
+        case VoiceFrg::ChargeCompleted:
+        case VoiceFrg::BalanceNotEnough:
+        case VoiceFrg::NotAvailable:
+            return Wtn6::Priority::High;
+        default:
+            return Wtn6::Priority::Normal;
+    }
+}
 
 void Wtn6::init() {
     rt_pin_mode(WTN_PIN_DATA, PIN_MODE_OUTPUT);
     rt_pin_mode(WTN_PIN_BUSY, PIN_MODE_INPUT);
     rt_pin_write(WTN_PIN_DATA, PIN_HIGH);
 
-    tim = rt_device_find("timer2");
+    tim = rt_device_find(WTN6_TIMER);
     rt_device_open(tim, RT_DEVICE_OFLAG_RDWR);
 
     auto mode = HWTIMER_MODE_ONESHOT;
     rt_device_control(tim, HWTIMER_CTRL_MODE_SET, &mode);
+    rt_device_set_rx_indicate(tim, [](auto dev, auto size) -> rt_err_t {
+        onTimeout();
+        return RT_EOK;
+    });
 
     event = rt_event_create(LOG_TAG, RT_IPC_FLAG_FIFO);
-    writeMailbox = rt_mb_create(LOG_TAG, 32, RT_IPC_FLAG_FIFO);
-    writeThread = rt_thread_create(LOG_TAG, writeEntry, this, 256, 3, 1);
+    writeThread = rt_thread_create(LOG_TAG, writeEntry, this, 384, 3, 1);
     rt_thread_startup(writeThread);
 }
 
-void Wtn6::write(uint8_t data) {
-    rt_mb_send(writeMailbox, data);
+void Wtn6::write(uint8_t data, Priority priority) {
+    rt_base_t level = rt_hw_interrupt_disable();
+
+    for(auto i = 0; i < queueLen; i++) {
+        if(queue[i].data == data) {
+            if(priority <= queue[i].priority) {
+                rt_hw_interrupt_enable(level);
+                return;
+            }
+            //提升优先级时移出原位置, 由下面按优先级重新插入
+            rt_memmove(&queue[i], &queue[i + 1], (queueLen - i - 1) * sizeof(Item));
+            queueLen--;
+            break;
+        }
+    }
+
+    auto cancelled = false;
+    for(auto& rule: supersede_rules) {
+        if((rt_uint8_t)rule.voice != data)
+            continue;
+        for(auto i = 0; i < queueLen; i++) {
+            if(queue[i].data == (rt_uint8_t)rule.cancels) {
+                rt_memmove(&queue[i], &queue[i + 1], (queueLen - i - 1) * sizeof(Item));
+                queueLen--;
+                i--;
+                cancelled = cancelled || rule.mutual;
+            }
+        }
+    }
+    if(cancelled) {
+        rt_hw_interrupt_enable(level);
+        return;
+    }
+
+    if(queueLen == WTN6_QUEUE_SIZE) {
+        //队列已满时丢弃优先级最低且最早入队的一条
+        auto victim = 0;
+        for(auto i = 1; i < queueLen; i++) {
+            if(queue[i].priority < queue[victim].priority) {
+                victim = i;
+            }
+        }
+        if(queue[victim].priority > priority) {
+            rt_hw_interrupt_enable(level);
+            return;
+        }
+        rt_memmove(&queue[victim], &queue[victim + 1], (queueLen - victim - 1) * sizeof(Item));
+        queueLen--;
+    }
+
+    //同优先级保持先后顺序
+    auto pos = queueLen;
+    while(pos > 0 && queue[pos - 1].priority < priority) {
+        queue[pos] = queue[pos - 1];
+        pos--;
+    }
+    queue[pos] = {data, priority};
+    queueLen++;
+
+    rt_hw_interrupt_enable(level);
+    rt_event_send(event, (rt_uint32_t)events::enqueued);
 }
 
 void Wtn6::operator << (uint8_t data) {
@@ -51,7 +147,7 @@ void Wtn6::operator << (uint8_t data) {
 }
 
 void Wtn6::operator << (VoiceFrg voice) {
-    write((rt_uint8_t)voice);
+    write((rt_uint8_t)voice, voice_priority(voice));
 }
 
 bool Wtn6::isBuzy() {
@@ -60,46 +156,58 @@ bool Wtn6::isBuzy() {
 
 void Wtn6::writeEntry(void* p) {
     Wtn6* self = (Wtn6*)p;
-    rt_ubase_t data;
     while(true) {
-        rt_mb_recv(self->writeMailbox, &data, RT_WAITING_FOREVER);
-        rt_pin_write(WTN_PIN_DATA, PIN_LOW);
-        self->timeout_us(5000);
-        rt_pin_write(WTN_PIN_DATA, PIN_HIGH);
-
-        for(auto i = 0; i < 8; i++) {
-            self->writeBit((data & (1 << i)) != 0);
+        rt_event_recv(self->event, (rt_uint32_t)events::enqueued, RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, RT_WAITING_FOREVER, RT_NULL);
+        while(true) {
+            //上一条播放结束前不出队, 期间入队的语音仍可被合并或取消
+            self->waitIdle();
+
+            rt_base_t level = rt_hw_interrupt_disable();
+            if(self->queueLen == 0) {
+                rt_hw_interrupt_enable(level);
+                break;
+            }
+            auto item = self->queue[0];
+            self->queueLen--;
+            rt_memmove(&self->queue[0], &self->queue[1], self->queueLen * sizeof(Item));
+            rt_hw_interrupt_enable(level);
+
+            self->emit(item.data);
+            rt_thread_mdelay(WTN6_BUSY_SETTLE);
         }
+    }
+}
 
-        rt_pin_write(WTN_PIN_DATA, PIN_HIGH);
+void Wtn6::waitIdle() {
+    for(auto waited = 0; isBuzy() && waited < WTN6_BUSY_TIMEOUT; waited += 10) {
+        rt_thread_mdelay(10);
     }
 }
 
-void Wtn6::writeBit(bool bit) {
-    auto delayHigh = 200, delayLow = 600;
-    if(bit) {
-        delayHigh = 600;
-        delayLow = 200;
+//整个字节的波形预先算好, 由定时器中断依次切换电平并装载下一段
+void Wtn6::emit(uint8_t data) {
+    segs[0] = {PIN_LOW, {sec: 0, usec: 5000}};
+    for(auto i = 0; i < 8; i++) {
+        bool bit = (data & (1 << i)) != 0;
+        segs[1 + i * 2] = {PIN_HIGH, {sec: 0, usec: bit ? 600 : 200}};
+        segs[2 + i * 2] = {PIN_LOW, {sec: 0, usec: bit ? 200 : 600}};
     }
 
-    rt_pin_write(WTN_PIN_DATA, PIN_HIGH);
-    timeout_us(delayHigh);
-    rt_pin_write(WTN_PIN_DATA, PIN_LOW);
-    timeout_us(delayLow);
+    segIdx = 0;
+    rt_pin_write(WTN_PIN_DATA, segs[0].level);
+    rt_device_write(tim, 0, &segs[0].timeout, sizeof(segs[0].timeout));
+    rt_event_recv(event, (rt_uint32_t)events::done, RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, RT_WAITING_FOREVER, RT_NULL);
 }
 
-void Wtn6::timeout_us(int timeout) {
-    auto to = rt_hwtimerval_t {
-        sec: 0,
-        usec: timeout,
-    };
-
-    rt_device_set_rx_indicate(tim, [](auto dev, auto size) -> rt_err_t {
-        rt_event_send(self->event, (rt_uint32_t)events::timeout);
-        return RT_EOK;
-    });
-    rt_device_write(tim, 0, &to, sizeof(to));
-    rt_event_recv(event, (rt_uint32_t)events::timeout, RT_EVENT_FLAG_AND | RT_EVENT_FLAG_CLEAR, RT_WAITING_FOREVER, RT_NULL);
+void Wtn6::onTimeout() {
+    auto idx = ++self->segIdx;
+    if(idx < SEG_COUNT) {
+        rt_pin_write(WTN_PIN_DATA, self->segs[idx].level);
+        rt_device_write(self->tim, 0, &self->segs[idx].timeout, sizeof(self->segs[idx].timeout));
+    } else {
+        rt_pin_write(WTN_PIN_DATA, PIN_HIGH);
+        rt_event_send(self->event, (rt_uint32_t)events::done);
+    }
 }
 
 Wtn6 wtn6;
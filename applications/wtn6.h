@@ -10,6 +10,10 @@
 #ifndef APPLICATIONS_WTN6_H_
 #define APPLICATIONS_WTN6_H_
 
+#define WTN6_QUEUE_SIZE 8
+#define WTN6_BUSY_TIMEOUT 15000 //单条语音最长播放时间(ms)
+#define WTN6_BUSY_SETTLE 50 //发送后等待BUSY脚拉低的时间(ms)
+
 enum class VoiceFrg: rt_uint8_t {
     Slience, //20ms静音
     PortAPluged, //一号插座已插入
@@ -30,9 +34,16 @@ enum class VoiceFrg: rt_uint8_t {
 };
 
 struct Wtn6 {
+    enum class Priority: rt_uint8_t {
+        Low,
+        Normal,
+        High,
+    };
+
     void init();
 
-    void write(uint8_t data);
+    //排队播放: 相同语音合并, 尚未播放的插入/拔出提示互相抵消, 高优先级先播放
+    void write(uint8_t data, Priority priority = Priority::Normal);
 
     void operator << (uint8_t data);
 
@@ -43,19 +54,39 @@ struct Wtn6 {
 private:
     static void writeEntry(void* p);
 
-    void writeBit(bool bit);
+    static void onTimeout();
 
-    void timeout_us(int timeout);
+    void emit(uint8_t data);
+
+    void waitIdle();
 
     enum class events {
-        timeout = 1,
+        done = 1,
+        enqueued = 2,
+    };
+
+    struct Item {
+        rt_uint8_t data;
+        Priority priority;
+    };
+
+    //一个字节的完整波形: 5ms起始低电平 + 8位(高低电平各一段)
+    static const int SEG_COUNT = 17;
+    struct Seg {
+        rt_uint8_t level;
+        rt_hwtimerval_t timeout;
     };
 
     rt_device_t tim;
     rt_event_t event;
     static Wtn6* self;
     rt_thread_t writeThread;
-    rt_mailbox_t writeMailbox;
+
+    Item queue[WTN6_QUEUE_SIZE];
+    int queueLen = 0;
+
+    Seg segs[SEG_COUNT];
+    volatile int segIdx = 0;
 };
 
 extern Wtn6 wtn6;
@@ -127,7 +127,9 @@ extern "C"
  *                 such as     #define HAL_SPI_MODULE_ENABLED
  */
 
-/*#define BSP_USING_SPI1*/
+#define BSP_USING_SPI1 //RC522: PA4 CS, PA5 SCK, PA6 MISO, PA7 MOSI
+/*#define BSP_SPI1_RX_USING_DMA*/
+/* SPI1 TX DMA shares DMA1_Channel3 with UART3 RX DMA, keep it disabled */
 /*#define BSP_USING_SPI2*/
 /*#define BSP_USING_SPI3*/
 
@@ -372,7 +374,7 @@ extern "C"
  *
  */
 
-/*#define BSP_USING_ON_CHIP_FLASH*/
+#define BSP_USING_ON_CHIP_FLASH
 
 /*-------------------------- ON_CHIP_FLASH CONFIG END --------------------------*/
 
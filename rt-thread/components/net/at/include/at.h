@@ -27,6 +27,15 @@ extern "C" {
 #define AT_CMD_MAX_LEN                 128
 #endif
 
+/* the number of pooled response objects, 0 means always allocate from heap */
+#ifndef AT_RESP_POOL_NUM
+#define AT_RESP_POOL_NUM               0
+#endif
+
+#ifndef AT_RESP_POOL_BUF_SIZE
+#define AT_RESP_POOL_BUF_SIZE          256
+#endif
+
 /* the server AT commands new line sign */
 #if defined(AT_CMD_END_MARK_CRLF)
 #define AT_CMD_END_MARK                "\r\n"
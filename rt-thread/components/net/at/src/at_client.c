@@ -8,6 +8,7 @@
  * 2018-03-30     chenyong     first version
  * 2018-04-12     chenyong     add client implement
  * 2018-08-17     chenyong     multiple client support
+ * 2020-11-14     imgcr        add response object pool
  */
 
 #include <at.h>
@@ -31,6 +32,38 @@ extern rt_size_t at_vprintfln(rt_device_t device, const char *format, va_list ar
 extern void at_print_raw_cmd(const char *type, const char *cmd, rt_size_t size);
 extern const char *at_get_last_cmd(rt_size_t *cmd_size);
 
+#if AT_RESP_POOL_NUM > 0
+/* response object and its buffer are allocated from one pool block */
+struct at_resp_block
+{
+    struct at_response resp;
+    char buf[AT_RESP_POOL_BUF_SIZE];
+};
+
+static struct rt_mempool at_resp_pool;
+ALIGN(RT_ALIGN_SIZE)
+static rt_uint8_t at_resp_pool_mem[AT_RESP_POOL_NUM * (RT_ALIGN(sizeof(struct at_resp_block), RT_ALIGN_SIZE) + sizeof(rt_uint8_t *))];
+
+static int at_resp_pool_init(void)
+{
+    return rt_mp_init(&at_resp_pool, "at_resp", at_resp_pool_mem, sizeof(at_resp_pool_mem),
+            sizeof(struct at_resp_block));
+}
+INIT_PREV_EXPORT(at_resp_pool_init);
+
+static struct at_resp_block *at_resp_get_block(at_response_t resp)
+{
+    rt_uint8_t *ptr = (rt_uint8_t *) resp;
+
+    if (ptr >= at_resp_pool_mem && ptr < at_resp_pool_mem + sizeof(at_resp_pool_mem))
+    {
+        return (struct at_resp_block *) resp;
+    }
+
+    return RT_NULL;
+}
+#endif /* AT_RESP_POOL_NUM > 0 */
+
 /**
  * Create response object.
  *
@@ -47,6 +80,28 @@ at_response_t at_create_resp(rt_size_t buf_size, rt_size_t line_num, rt_int32_t
 {
     at_response_t resp = RT_NULL;
 
+#if AT_RESP_POOL_NUM > 0
+    /* small response objects are taken from the pool, fall back to heap when it is exhausted */
+    if (buf_size <= AT_RESP_POOL_BUF_SIZE)
+    {
+        struct at_resp_block *block = (struct at_resp_block *) rt_mp_alloc(&at_resp_pool, RT_WAITING_NO);
+        if (block)
+        {
+            resp = &block->resp;
+            resp->buf = block->buf;
+            resp->buf[0] = '\0';
+            resp->buf_size = buf_size;
+            resp->buf_len = 0;
+            resp->line_num = line_num;
+            resp->line_counts = 0;
+            resp->timeout = timeout;
+
+            return resp;
+        }
+        LOG_D("AT response pool is empty, allocate from heap.");
+    }
+#endif /* AT_RESP_POOL_NUM > 0 */
+
     resp = (at_response_t) rt_calloc(1, sizeof(struct at_response));
     if (resp == RT_NULL)
     {
@@ -77,6 +132,20 @@ at_response_t at_create_resp(rt_size_t buf_size, rt_size_t line_num, rt_int32_t
  */
 void at_delete_resp(at_response_t resp)
 {
+#if AT_RESP_POOL_NUM > 0
+    struct at_resp_block *block = at_resp_get_block(resp);
+    if (block)
+    {
+        /* the buffer may have been moved to heap by at_resp_set_info() */
+        if (resp->buf != block->buf)
+        {
+            rt_free(resp->buf);
+        }
+        rt_mp_free(block);
+        return;
+    }
+#endif /* AT_RESP_POOL_NUM > 0 */
+
     if (resp && resp->buf)
     {
         rt_free(resp->buf);
@@ -106,6 +175,30 @@ at_response_t at_resp_set_info(at_response_t resp, rt_size_t buf_size, rt_size_t
 {
     RT_ASSERT(resp);
 
+#if AT_RESP_POOL_NUM > 0
+    struct at_resp_block *block = at_resp_get_block(resp);
+    if (block && resp->buf == block->buf)
+    {
+        if (buf_size <= AT_RESP_POOL_BUF_SIZE)
+        {
+            /* pool buffer is large enough, no reallocation */
+            resp->buf_size = buf_size;
+        }
+        else
+        {
+            char *buf = (char *) rt_calloc(1, buf_size);
+            if (!buf)
+            {
+                LOG_D("No memory for realloc response buffer size(%d).", buf_size);
+                return RT_NULL;
+            }
+            rt_memcpy(buf, resp->buf, resp->buf_size);
+            resp->buf = buf;
+            resp->buf_size = buf_size;
+        }
+    }
+    else
+#endif /* AT_RESP_POOL_NUM > 0 */
     if (resp->buf_size != buf_size)
     {
         resp->buf_size = buf_size;
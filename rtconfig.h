@@ -79,9 +79,12 @@
 #define RT_SERIAL_USING_DMA
 #define RT_SERIAL_RB_BUFSZ 256
 #define RT_USING_HWTIMER
+#define RT_USING_CPUTIME
+#define RT_USING_CPUTIME_CORTEXM
 #define RT_USING_I2C
 #define RT_USING_I2C_BITOPS
 #define RT_USING_PIN
+#define RT_USING_SPI
 #define RT_USING_WDT
 
 /* Using USB */
@@ -114,6 +117,8 @@
 #define AT_DEBUG
 #define AT_USING_CLIENT
 #define AT_CLIENT_NUM_MAX 1
+#define AT_RESP_POOL_NUM 3
+#define AT_RESP_POOL_BUF_SIZE 256
 #define AT_PRINT_RAW_CMD
 #define AT_CMD_MAX_LEN 512
 #define AT_SW_VERSION_NUM 0x10300